@@ -0,0 +1,72 @@
+#ifndef ACTIVE_SPANS_H
+#define ACTIVE_SPANS_H
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+/**
+ * Run of active pixels [start, end) in a row.
+ */
+struct Span {
+    int start;
+    int end;
+};
+
+/**
+ * Active pixels of a static exclusion mask stored as runs per row, so the
+ * subtractors can loop over the pixels they care about without testing
+ * the mask per pixel.
+ */
+class ActiveSpans {
+public:
+    /**
+     * Every pixel of a rows x cols image is active.
+     */
+    ActiveSpans(const int rows = 0, const int cols = 0);
+
+    /**
+     * Pixels where mask (CV_8U) is non zero are active.
+     */
+    ActiveSpans(const cv::Mat &mask);
+
+    cv::Size size() const;
+    bool empty() const;
+
+    /**
+     * True when no pixel is excluded.
+     */
+    bool full() const;
+
+    /**
+     * Number of active pixels in rows [row_start, row_end).
+     */
+    int count(const int row_start, const int row_end) const;
+    int count() const;
+
+    inline const Span* rowBegin(const int r) const {
+        return this->spans.data() + this->row_index[r];
+    }
+
+    inline const Span* rowEnd(const int r) const {
+        return this->spans.data() + this->row_index[r + 1];
+    }
+
+    /**
+     * Sets the excluded pixels of image (CV_8U, same size) to zero.
+     */
+    void clearExcluded(cv::Mat &image) const;
+
+private:
+    int rows;
+    int cols;
+
+    std::vector<Span> spans;
+    // Spans of row r are spans[row_index[r]] to spans[row_index[r + 1]]
+    std::vector<int> row_index;
+    // Active pixels in the rows before row r
+    std::vector<int> active_before;
+
+    void addRow(const unsigned char *mask_row);
+};
+
+#endif //ACTIVE_SPANS_H
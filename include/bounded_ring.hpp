@@ -0,0 +1,89 @@
+#ifndef BOUNDED_RING_H
+#define BOUNDED_RING_H
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * Fixed number of preallocated slots passed from one producer thread to one
+ * consumer thread, in order.
+ *
+ * The producer fills the slot returned by acquire() and hands it over with
+ * publish(), acquire() blocks while every slot is waiting for the consumer.
+ * The consumer reads the slot returned by front() and gives it back with
+ * release(). Slots are reused, so buffers inside of them survive between
+ * rounds. After close() acquire() returns NULL and front() returns NULL once
+ * the published slots are drained.
+ */
+template <typename T>
+class BoundedRing {
+public:
+    BoundedRing(const size_t capacity) : slots(capacity > 0 ? capacity : 1) {
+        this->head = 0;
+        this->count = 0;
+        this->closed = false;
+    }
+
+    size_t capacity() const {
+        return this->slots.size();
+    }
+
+    T* acquire() {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        while (!this->closed && this->count == this->slots.size()) {
+            this->not_full.wait(lock);
+        }
+        if (this->closed) {
+            return NULL;
+        }
+        return &this->slots[(this->head + this->count) % this->slots.size()];
+    }
+
+    void publish() {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->count++;
+        this->not_empty.notify_one();
+    }
+
+    T* front() {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        while (!this->closed && this->count == 0) {
+            this->not_empty.wait(lock);
+        }
+        if (this->count == 0) {
+            return NULL;
+        }
+        return &this->slots[this->head];
+    }
+
+    void release() {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->head = (this->head + 1) % this->slots.size();
+        this->count--;
+        this->not_full.notify_one();
+    }
+
+    /**
+     * No more slots are published, either side may close the ring.
+     */
+    void close() {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->closed = true;
+        this->not_full.notify_all();
+        this->not_empty.notify_all();
+    }
+
+private:
+    std::vector<T> slots;
+    // First published slot and the number of published slots
+    size_t head;
+    size_t count;
+    bool closed;
+
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+};
+
+#endif //BOUNDED_RING_H
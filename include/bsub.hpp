@@ -1,8 +1,13 @@
 #ifndef BSUB_H
 #define BSUB_H
 
+#include <vector>
 #include <opencv2/video/background_segm.hpp>
 
+#include "foreground_stats.hpp"
+#include "active_spans.hpp"
+#include "checkpoint.hpp"
+
 /**
  * Simple Background subtraction class.
  */
@@ -13,16 +18,66 @@ public:
     ~BSub();
     void operator()(cv::InputArray image, cv::OutputArray fgmask, double learning_rate = 0);
     void apply(cv::InputArray image, cv::OutputArray fgmask, double learning_rate = 0);
+    /**
+     * Update the model like apply() but only report foreground statistics,
+     * no mask is built or smoothed.
+     */
+    virtual void applyStats(cv::InputArray image, ForegroundStats &stats, double learning_rate = 0);
+    /**
+     * Cheap model update for frames known to hold no foreground, every
+     * active pixel is taken as background. By default the same as
+     * applyStats().
+     */
+    virtual void maintain(cv::InputArray image, double learning_rate = 0);
     void getBackgroundImage(cv::OutputArray background_image) const;
-    std::ostream& print(std::ostream &out) const;
+    /**
+     * Pixels where mask is zero are never classified, updated or counted and
+     * are always background in the foreground mask. Statistics use the
+     * number of active pixels as total. The mask has to match the frames.
+     */
+    virtual void setExclusionMask(const cv::Mat &mask);
+    virtual std::ostream& print(std::ostream &out) const;
     void read(const cv::FileNode &node);
     void write(cv::FileStorage &fs) const;
+    /**
+     * Binary checkpoint of the model, read() and write() remain as a YAML
+     * export for debugging. readBinary() returns false when a block is
+     * missing or does not fit, the subtractor should be dropped then.
+     */
+    virtual bool readBinary(CheckpointReader &reader);
+    virtual void writeBinary(CheckpointWriter &writer) const;
 
 protected:
+    // 8-bit difference above which a pixel is foreground
+    static const int FOREGROUND_THRESHOLD = 150;
+
     cv::Ptr<cv::Mat> model;
+    ActiveSpans active;
+
+    /**
+     * Makes sure active covers frames of the given size, without an
+     * exclusion mask every pixel is active.
+     */
+    void updateActiveSpans(const cv::Size &size);
 
 private:
-    void updateModel(const cv::Mat &dist, const double &rate);
+    // Learning rate as a weight out of 256
+    static const int BLEND_ONE = 256;
+
+    // Reused between frames so a frame allocates nothing
+    cv::Mat gray;
+    std::vector<unsigned char> row_mask;
+
+    /**
+     * Gray version of the frame, the model is initiated on the first one.
+     */
+    cv::Mat prepareFrame(cv::InputArray image);
+
+    /**
+     * Classifies the active pixels and updates the model in one pass, the
+     * mask and stats are optional.
+     */
+    void blendFrame(const cv::Mat &input_image, cv::Mat *mask, ForegroundStats *stats, const double &rate);
 };
 
 static void write(cv::FileStorage &fs, const std::string&, const BSub &x) {
@@ -0,0 +1,887 @@
+#ifndef BSUB_KERNELS_H
+#define BSUB_KERNELS_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "counter_rng.hpp"
+
+/**
+ * Vectorized building blocks shared by the sample based background
+ * subtractors. Every kernel has a scalar reference implementation that is
+ * used when the target has no SSE2 support.
+ */
+
+inline int popCount(const unsigned int &bits) {
+#ifdef _MSC_VER
+    return __popcnt(bits);
+#else
+    return __builtin_popcount(bits);
+#endif
+}
+
+/**
+ * Counts the samples within radius of val. Counting stops once max_matches
+ * have been found so the result is never larger than max_matches.
+ */
+inline int countMatchesScalar(
+        const unsigned char *samples,
+        const int num_samples,
+        const unsigned char val,
+        const int radius,
+        const int max_matches) {
+    int matches = 0;
+    for (int z = 0; z < num_samples; z++) {
+        int dist = abs(static_cast<int>(val) - samples[z]);
+        if (dist <= radius) {
+            matches++;
+            if (matches >= max_matches) {
+                break;
+            }
+        }
+    }
+    return matches;
+}
+
+/**
+ * SIMD version of countMatchesScalar, returns exactly the same value.
+ */
+inline int countMatches(
+        const unsigned char *samples,
+        const int num_samples,
+        const unsigned char val,
+        const int radius,
+        const int max_matches) {
+#if defined(__SSE2__)
+    if (radius < 0) {
+        return 0;
+    }
+    const char rad = static_cast<char>(radius > 255 ? 255 : radius);
+    int matches = 0;
+    int z = 0;
+#if defined(__AVX2__)
+    const __m256i val_32 = _mm256_set1_epi8(static_cast<char>(val));
+    const __m256i rad_32 = _mm256_set1_epi8(rad);
+    for (; z + 32 <= num_samples; z += 32) {
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(samples + z));
+        __m256i d = _mm256_or_si256(_mm256_subs_epu8(s, val_32), _mm256_subs_epu8(val_32, s));
+        __m256i m = _mm256_cmpeq_epi8(_mm256_min_epu8(d, rad_32), d);
+        matches += popCount(static_cast<unsigned int>(_mm256_movemask_epi8(m)));
+        if (matches >= max_matches) {
+            return max_matches;
+        }
+    }
+#endif
+    const __m128i val_16 = _mm_set1_epi8(static_cast<char>(val));
+    const __m128i rad_16 = _mm_set1_epi8(rad);
+    for (; z + 16 <= num_samples; z += 16) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + z));
+        __m128i d = _mm_or_si128(_mm_subs_epu8(s, val_16), _mm_subs_epu8(val_16, s));
+        __m128i m = _mm_cmpeq_epi8(_mm_min_epu8(d, rad_16), d);
+        matches += popCount(static_cast<unsigned int>(_mm_movemask_epi8(m)));
+        if (matches >= max_matches) {
+            return max_matches;
+        }
+    }
+    if (z < num_samples) {
+        matches += countMatchesScalar(samples + z, num_samples - z, val, radius, max_matches - matches);
+    }
+    return matches < max_matches ? matches : max_matches;
+#else
+    return countMatchesScalar(samples, num_samples, val, radius, max_matches);
+#endif
+}
+
+/**
+ * Counts, for every pixel of a row, the samples within radius of vals[c].
+ * samples points at the row in the first sample plane and the rows of the
+ * following samples are sample_step bytes apart. Counts are capped at
+ * max_matches.
+ */
+inline void countMatchesRowScalar(
+        const unsigned char *samples,
+        const size_t sample_step,
+        const int num_samples,
+        const unsigned char *vals,
+        const int cols,
+        const int radius,
+        const int max_matches,
+        unsigned char *matches) {
+    for (int c = 0; c < cols; c++) {
+        int count = 0;
+        for (int z = 0; z < num_samples && count < max_matches; z++) {
+            int dist = abs(static_cast<int>(vals[c]) - samples[z * sample_step + c]);
+            if (dist <= radius) {
+                count++;
+            }
+        }
+        matches[c] = count;
+    }
+}
+
+/**
+ * SIMD version of countMatchesRowScalar, processes 16 (SSE2) or 32 (AVX2)
+ * pixels per instruction.
+ */
+inline void countMatchesRow(
+        const unsigned char *samples,
+        const size_t sample_step,
+        const int num_samples,
+        const unsigned char *vals,
+        const int cols,
+        const int radius,
+        const int max_matches,
+        unsigned char *matches) {
+#if defined(__SSE2__)
+    if (radius < 0 || max_matches > 255) {
+        countMatchesRowScalar(samples, sample_step, num_samples, vals, cols, radius, max_matches, matches);
+        return;
+    }
+    const char rad = static_cast<char>(radius > 255 ? 255 : radius);
+    int c = 0;
+#if defined(__AVX2__)
+    const __m256i rad_32 = _mm256_set1_epi8(rad);
+    const __m256i one_32 = _mm256_set1_epi8(1);
+    const __m256i max_32 = _mm256_set1_epi8(static_cast<char>(max_matches));
+    for (; c + 32 <= cols; c += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(vals + c));
+        __m256i count = _mm256_setzero_si256();
+        const unsigned char *s_ptr = samples + c;
+        for (int z = 0; z < num_samples; z++, s_ptr += sample_step) {
+            __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s_ptr));
+            __m256i d = _mm256_or_si256(_mm256_subs_epu8(s, v), _mm256_subs_epu8(v, s));
+            __m256i m = _mm256_cmpeq_epi8(_mm256_min_epu8(d, rad_32), d);
+            count = _mm256_adds_epu8(count, _mm256_and_si256(m, one_32));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(matches + c), _mm256_min_epu8(count, max_32));
+    }
+#endif
+    const __m128i rad_16 = _mm_set1_epi8(rad);
+    const __m128i one_16 = _mm_set1_epi8(1);
+    const __m128i max_16 = _mm_set1_epi8(static_cast<char>(max_matches));
+    for (; c + 16 <= cols; c += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(vals + c));
+        __m128i count = _mm_setzero_si128();
+        const unsigned char *s_ptr = samples + c;
+        for (int z = 0; z < num_samples; z++, s_ptr += sample_step) {
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s_ptr));
+            __m128i d = _mm_or_si128(_mm_subs_epu8(s, v), _mm_subs_epu8(v, s));
+            __m128i m = _mm_cmpeq_epi8(_mm_min_epu8(d, rad_16), d);
+            count = _mm_adds_epu8(count, _mm_and_si128(m, one_16));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(matches + c), _mm_min_epu8(count, max_16));
+    }
+    if (c < cols) {
+        countMatchesRowScalar(samples + c, sample_step, num_samples, vals + c, cols - c, radius, max_matches, matches + c);
+    }
+#else
+    countMatchesRowScalar(samples, sample_step, num_samples, vals, cols, radius, max_matches, matches);
+#endif
+}
+
+/**
+ * Sample of column c in a nibble packed row, see SampleModel::PACKED.
+ */
+inline unsigned char packedNibble(const unsigned char *row, const int c) {
+    const unsigned char packed = row[(c >> 5) * 16 + (c & 15)];
+    return (c & 16) ? packed >> 4 : packed & 0x0F;
+}
+
+/**
+ * Unpacks the first cols samples of a nibble packed row into one byte per
+ * sample.
+ */
+inline void unpackNibbleRow(const unsigned char *packed, const int cols, unsigned char *out) {
+    int c = 0;
+#if defined(__SSE2__)
+    const __m128i low_16 = _mm_set1_epi8(0x0F);
+    for (; c + 32 <= cols; c += 32) {
+        const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(packed + c / 2));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + c), _mm_and_si128(p, low_16));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + c + 16), _mm_and_si128(_mm_srli_epi16(p, 4), low_16));
+    }
+#endif
+    for (; c < cols; c++) {
+        out[c] = packedNibble(packed, c);
+    }
+}
+
+/**
+ * countMatchesRowScalar for nibble packed sample rows.
+ */
+inline void countMatchesPackedRowScalar(
+        const unsigned char *samples,
+        const size_t sample_step,
+        const int num_samples,
+        const unsigned char *vals,
+        const int cols,
+        const int radius,
+        const int max_matches,
+        unsigned char *matches) {
+    for (int c = 0; c < cols; c++) {
+        int count = 0;
+        for (int z = 0; z < num_samples && count < max_matches; z++) {
+            int dist = abs(static_cast<int>(vals[c]) - packedNibble(samples + z * sample_step, c));
+            if (dist <= radius) {
+                count++;
+            }
+        }
+        matches[c] = count;
+    }
+}
+
+/**
+ * SIMD version of countMatchesPackedRowScalar. Every load brings in 32
+ * (SSE2) or 64 (AVX2) samples which are unpacked in registers, so the model
+ * is read at half the bandwidth of countMatchesRow.
+ */
+inline void countMatchesPackedRow(
+        const unsigned char *samples,
+        const size_t sample_step,
+        const int num_samples,
+        const unsigned char *vals,
+        const int cols,
+        const int radius,
+        const int max_matches,
+        unsigned char *matches) {
+#if defined(__SSE2__)
+    if (radius < 0 || max_matches > 255) {
+        countMatchesPackedRowScalar(samples, sample_step, num_samples, vals, cols, radius, max_matches, matches);
+        return;
+    }
+    const char rad = static_cast<char>(radius > 255 ? 255 : radius);
+    int c = 0;
+#if defined(__AVX2__)
+    // The two 128 bit lanes hold consecutive blocks, pixels c to c + 31 and
+    // c + 32 to c + 63.
+    const __m256i rad_32 = _mm256_set1_epi8(rad);
+    const __m256i one_32 = _mm256_set1_epi8(1);
+    const __m256i max_32 = _mm256_set1_epi8(static_cast<char>(max_matches));
+    const __m256i low_32 = _mm256_set1_epi8(0x0F);
+    for (; c + 64 <= cols; c += 64) {
+        const __m256i v_lo = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(vals + c))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(vals + c + 32)), 1);
+        const __m256i v_hi = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(vals + c + 16))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(vals + c + 48)), 1);
+        __m256i count_lo = _mm256_setzero_si256();
+        __m256i count_hi = _mm256_setzero_si256();
+        const unsigned char *s_ptr = samples + c / 2;
+        for (int z = 0; z < num_samples; z++, s_ptr += sample_step) {
+            const __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s_ptr));
+            const __m256i s_lo = _mm256_and_si256(p, low_32);
+            const __m256i s_hi = _mm256_and_si256(_mm256_srli_epi16(p, 4), low_32);
+            __m256i d = _mm256_or_si256(_mm256_subs_epu8(s_lo, v_lo), _mm256_subs_epu8(v_lo, s_lo));
+            __m256i m = _mm256_cmpeq_epi8(_mm256_min_epu8(d, rad_32), d);
+            count_lo = _mm256_adds_epu8(count_lo, _mm256_and_si256(m, one_32));
+            d = _mm256_or_si256(_mm256_subs_epu8(s_hi, v_hi), _mm256_subs_epu8(v_hi, s_hi));
+            m = _mm256_cmpeq_epi8(_mm256_min_epu8(d, rad_32), d);
+            count_hi = _mm256_adds_epu8(count_hi, _mm256_and_si256(m, one_32));
+        }
+        count_lo = _mm256_min_epu8(count_lo, max_32);
+        count_hi = _mm256_min_epu8(count_hi, max_32);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(matches + c), _mm256_castsi256_si128(count_lo));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(matches + c + 16), _mm256_castsi256_si128(count_hi));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(matches + c + 32), _mm256_extracti128_si256(count_lo, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(matches + c + 48), _mm256_extracti128_si256(count_hi, 1));
+    }
+#endif
+    const __m128i rad_16 = _mm_set1_epi8(rad);
+    const __m128i one_16 = _mm_set1_epi8(1);
+    const __m128i max_16 = _mm_set1_epi8(static_cast<char>(max_matches));
+    const __m128i low_16 = _mm_set1_epi8(0x0F);
+    for (; c + 32 <= cols; c += 32) {
+        const __m128i v_lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(vals + c));
+        const __m128i v_hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(vals + c + 16));
+        __m128i count_lo = _mm_setzero_si128();
+        __m128i count_hi = _mm_setzero_si128();
+        const unsigned char *s_ptr = samples + c / 2;
+        for (int z = 0; z < num_samples; z++, s_ptr += sample_step) {
+            const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s_ptr));
+            const __m128i s_lo = _mm_and_si128(p, low_16);
+            const __m128i s_hi = _mm_and_si128(_mm_srli_epi16(p, 4), low_16);
+            __m128i d = _mm_or_si128(_mm_subs_epu8(s_lo, v_lo), _mm_subs_epu8(v_lo, s_lo));
+            __m128i m = _mm_cmpeq_epi8(_mm_min_epu8(d, rad_16), d);
+            count_lo = _mm_adds_epu8(count_lo, _mm_and_si128(m, one_16));
+            d = _mm_or_si128(_mm_subs_epu8(s_hi, v_hi), _mm_subs_epu8(v_hi, s_hi));
+            m = _mm_cmpeq_epi8(_mm_min_epu8(d, rad_16), d);
+            count_hi = _mm_adds_epu8(count_hi, _mm_and_si128(m, one_16));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(matches + c), _mm_min_epu8(count_lo, max_16));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(matches + c + 16), _mm_min_epu8(count_hi, max_16));
+    }
+    // The last partial block, columns stay where they are in the packed row.
+    for (; c < cols; c++) {
+        int count = 0;
+        for (int z = 0; z < num_samples && count < max_matches; z++) {
+            int dist = abs(static_cast<int>(vals[c]) - packedNibble(samples + z * sample_step, c));
+            if (dist <= radius) {
+                count++;
+            }
+        }
+        matches[c] = count;
+    }
+#else
+    countMatchesPackedRowScalar(samples, sample_step, num_samples, vals, cols, radius, max_matches, matches);
+#endif
+}
+
+/**
+ * Adds one sample plane to the running match counts and minimum distances
+ * of a row. A sample matches when its distance to vals[c] is at most
+ * radius[c]. matches should start at zero and min_dist at 255.
+ */
+inline void accumulateDistancesScalar(
+        const unsigned char *plane,
+        const unsigned char *vals,
+        const unsigned char *radius,
+        const int cols,
+        unsigned char *matches,
+        unsigned char *min_dist) {
+    for (int c = 0; c < cols; c++) {
+        int dist = abs(static_cast<int>(vals[c]) - plane[c]);
+        if (dist <= radius[c] && matches[c] < 255) {
+            matches[c]++;
+        }
+        if (dist < min_dist[c]) {
+            min_dist[c] = dist;
+        }
+    }
+}
+
+/**
+ * SIMD version of accumulateDistancesScalar, returns exactly the same
+ * values.
+ */
+inline void accumulateDistances(
+        const unsigned char *plane,
+        const unsigned char *vals,
+        const unsigned char *radius,
+        const int cols,
+        unsigned char *matches,
+        unsigned char *min_dist) {
+    int c = 0;
+#if defined(__AVX2__)
+    const __m256i one_32 = _mm256_set1_epi8(1);
+    for (; c + 32 <= cols; c += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(vals + c));
+        const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(plane + c));
+        const __m256i rad = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(radius + c));
+        const __m256i d = _mm256_or_si256(_mm256_subs_epu8(s, v), _mm256_subs_epu8(v, s));
+        const __m256i m = _mm256_cmpeq_epi8(_mm256_min_epu8(d, rad), d);
+        __m256i count = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(matches + c));
+        __m256i min = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(min_dist + c));
+        count = _mm256_adds_epu8(count, _mm256_and_si256(m, one_32));
+        min = _mm256_min_epu8(min, d);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(matches + c), count);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(min_dist + c), min);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i one_16 = _mm_set1_epi8(1);
+    for (; c + 16 <= cols; c += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(vals + c));
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(plane + c));
+        const __m128i rad = _mm_loadu_si128(reinterpret_cast<const __m128i*>(radius + c));
+        const __m128i d = _mm_or_si128(_mm_subs_epu8(s, v), _mm_subs_epu8(v, s));
+        const __m128i m = _mm_cmpeq_epi8(_mm_min_epu8(d, rad), d);
+        __m128i count = _mm_loadu_si128(reinterpret_cast<const __m128i*>(matches + c));
+        __m128i min = _mm_loadu_si128(reinterpret_cast<const __m128i*>(min_dist + c));
+        count = _mm_adds_epu8(count, _mm_and_si128(m, one_16));
+        min = _mm_min_epu8(min, d);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(matches + c), count);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(min_dist + c), min);
+    }
+#endif
+    if (c < cols) {
+        accumulateDistancesScalar(plane + c, vals + c, radius + c, cols - c, matches + c, min_dist + c);
+    }
+}
+
+/**
+ * accumulateDistancesScalar for the num_samples samples of a single pixel,
+ * as they are stored in the interleaved layout.
+ */
+inline void accumulatePixelDistancesScalar(
+        const unsigned char *samples,
+        const int num_samples,
+        const unsigned char val,
+        const unsigned char radius,
+        unsigned char *matches,
+        unsigned char *min_dist) {
+    for (int z = 0; z < num_samples; z++) {
+        accumulateDistancesScalar(samples + z, &val, &radius, 1, matches, min_dist);
+    }
+}
+
+/**
+ * SIMD version of accumulatePixelDistancesScalar, returns exactly the same
+ * values.
+ */
+inline void accumulatePixelDistances(
+        const unsigned char *samples,
+        const int num_samples,
+        const unsigned char val,
+        const unsigned char radius,
+        unsigned char *matches,
+        unsigned char *min_dist) {
+#if defined(__SSE2__)
+    int count = *matches;
+    int z = 0;
+    __m128i min_16 = _mm_set1_epi8(static_cast<char>(*min_dist));
+#if defined(__AVX2__)
+    const __m256i val_32 = _mm256_set1_epi8(static_cast<char>(val));
+    const __m256i rad_32 = _mm256_set1_epi8(static_cast<char>(radius));
+    __m256i min_32 = _mm256_set1_epi8(static_cast<char>(*min_dist));
+    for (; z + 32 <= num_samples; z += 32) {
+        const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(samples + z));
+        const __m256i d = _mm256_or_si256(_mm256_subs_epu8(s, val_32), _mm256_subs_epu8(val_32, s));
+        const __m256i m = _mm256_cmpeq_epi8(_mm256_min_epu8(d, rad_32), d);
+        count += popCount(static_cast<unsigned int>(_mm256_movemask_epi8(m)));
+        min_32 = _mm256_min_epu8(min_32, d);
+    }
+    min_16 = _mm_min_epu8(_mm256_castsi256_si128(min_32), _mm256_extracti128_si256(min_32, 1));
+#endif
+    const __m128i val_16 = _mm_set1_epi8(static_cast<char>(val));
+    const __m128i rad_16 = _mm_set1_epi8(static_cast<char>(radius));
+    for (; z + 16 <= num_samples; z += 16) {
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + z));
+        const __m128i d = _mm_or_si128(_mm_subs_epu8(s, val_16), _mm_subs_epu8(val_16, s));
+        const __m128i m = _mm_cmpeq_epi8(_mm_min_epu8(d, rad_16), d);
+        count += popCount(static_cast<unsigned int>(_mm_movemask_epi8(m)));
+        min_16 = _mm_min_epu8(min_16, d);
+    }
+    // Fold the lanes down to the smallest distance.
+    min_16 = _mm_min_epu8(min_16, _mm_srli_si128(min_16, 8));
+    min_16 = _mm_min_epu8(min_16, _mm_srli_si128(min_16, 4));
+    min_16 = _mm_min_epu8(min_16, _mm_srli_si128(min_16, 2));
+    min_16 = _mm_min_epu8(min_16, _mm_srli_si128(min_16, 1));
+    *matches = static_cast<unsigned char>(count < 255 ? count : 255);
+    *min_dist = static_cast<unsigned char>(_mm_cvtsi128_si32(min_16) & 0xff);
+    if (z < num_samples) {
+        accumulatePixelDistancesScalar(samples + z, num_samples - z, val, radius, matches, min_dist);
+    }
+#else
+    accumulatePixelDistancesScalar(samples, num_samples, val, radius, matches, min_dist);
+#endif
+}
+
+/**
+ * Constants of the HOFSub (PBAS) state adaptation.
+ */
+struct AdaptationParams {
+    float learning_rate;
+    int req_matches;
+    float thresh_scale;
+    float thresh_min;
+    float thresh_max;
+    float thresh_inc_rate;
+    float thresh_dec_rate;
+    float update_min;
+    float update_max;
+    float update_inc_rate;
+    float update_dec_rate;
+};
+
+/**
+ * Updates the decision distance (moving average of the minimum distance),
+ * the threshold and the update value of a row of pixels. update_threshold
+ * receives the new update values as CounterRNG::inverseThreshold and
+ * background[c] is set to 255 when the pixel had enough matches and 0
+ * otherwise.
+ */
+inline void adaptStateRowScalar(
+        const unsigned char *min_dist,
+        const unsigned char *matches,
+        const int cols,
+        const AdaptationParams &params,
+        float *distance,
+        float *threshold,
+        float *update,
+        uint32_t *update_threshold,
+        unsigned char *background) {
+    for (int c = 0; c < cols; c++) {
+        const float dist = params.learning_rate * min_dist[c] + (1 - params.learning_rate) * distance[c];
+
+        float thresh = threshold[c];
+        if (thresh > dist * params.thresh_scale) {
+            thresh = thresh * (1 - params.thresh_dec_rate);
+            if (thresh < params.thresh_min) {
+                thresh = params.thresh_min;
+            }
+        } else {
+            thresh = thresh * (1 + params.thresh_inc_rate);
+            if (thresh > params.thresh_max) {
+                thresh = params.thresh_max;
+            }
+        }
+
+        const bool is_background = matches[c] >= params.req_matches;
+        float upd = update[c];
+        if (is_background) {
+            upd = upd - params.update_dec_rate / dist;
+            if (upd < params.update_min) {
+                upd = params.update_min;
+            }
+        } else {
+            upd = upd + params.update_inc_rate / dist;
+            if (upd > params.update_max) {
+                upd = params.update_max;
+            }
+        }
+
+        distance[c] = dist;
+        threshold[c] = thresh;
+        update[c] = upd;
+        update_threshold[c] = CounterRNG::inverseThreshold(upd);
+        background[c] = is_background ? 255 : 0;
+    }
+}
+
+/**
+ * SIMD version of adaptStateRowScalar, 4 (SSE2) or 8 (AVX2) pixels at a
+ * time. Results agree with the scalar version up to float rounding.
+ */
+inline void adaptStateRow(
+        const unsigned char *min_dist,
+        const unsigned char *matches,
+        const int cols,
+        const AdaptationParams &params,
+        float *distance,
+        float *threshold,
+        float *update,
+        uint32_t *update_threshold,
+        unsigned char *background) {
+    int c = 0;
+#if defined(__AVX2__)
+    {
+        const __m256 rate = _mm256_set1_ps(params.learning_rate);
+        const __m256 keep = _mm256_set1_ps(1 - params.learning_rate);
+        const __m256i req = _mm256_set1_epi32(params.req_matches - 1);
+        const __m256 t_scale = _mm256_set1_ps(params.thresh_scale);
+        const __m256 t_min = _mm256_set1_ps(params.thresh_min);
+        const __m256 t_max = _mm256_set1_ps(params.thresh_max);
+        const __m256 t_inc = _mm256_set1_ps(1 + params.thresh_inc_rate);
+        const __m256 t_dec = _mm256_set1_ps(1 - params.thresh_dec_rate);
+        const __m256 u_min = _mm256_set1_ps(params.update_min);
+        const __m256 u_max = _mm256_set1_ps(params.update_max);
+        const __m256 u_inc = _mm256_set1_ps(params.update_inc_rate);
+        const __m256 u_dec = _mm256_set1_ps(params.update_dec_rate);
+        const __m256 p_scale = _mm256_set1_ps(2147483648.0f);
+        const __m256 p_max = _mm256_set1_ps(2147483520.0f);
+        const __m256 p_min = _mm256_setzero_ps();
+        for (; c + 8 <= cols; c += 8) {
+            const __m256 md = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(min_dist + c))));
+            const __m256i count = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(matches + c)));
+            const __m256 dist = _mm256_add_ps(_mm256_mul_ps(rate, md), _mm256_mul_ps(keep, _mm256_loadu_ps(distance + c)));
+
+            const __m256 thresh = _mm256_loadu_ps(threshold + c);
+            const __m256 shrink = _mm256_cmp_ps(thresh, _mm256_mul_ps(dist, t_scale), _CMP_GT_OQ);
+            const __m256 thresh_dec = _mm256_max_ps(_mm256_mul_ps(thresh, t_dec), t_min);
+            const __m256 thresh_inc = _mm256_min_ps(_mm256_mul_ps(thresh, t_inc), t_max);
+
+            const __m256 is_background = _mm256_castsi256_ps(_mm256_cmpgt_epi32(count, req));
+            const __m256 upd = _mm256_loadu_ps(update + c);
+            const __m256 upd_dec = _mm256_max_ps(_mm256_sub_ps(upd, _mm256_div_ps(u_dec, dist)), u_min);
+            const __m256 upd_inc = _mm256_min_ps(_mm256_add_ps(upd, _mm256_div_ps(u_inc, dist)), u_max);
+
+            _mm256_storeu_ps(distance + c, dist);
+            _mm256_storeu_ps(threshold + c, _mm256_blendv_ps(thresh_inc, thresh_dec, shrink));
+            const __m256 upd_new = _mm256_blendv_ps(upd_inc, upd_dec, is_background);
+            const __m256 scaled = _mm256_max_ps(_mm256_min_ps(_mm256_div_ps(p_scale, upd_new), p_max), p_min);
+            _mm256_storeu_ps(update + c, upd_new);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(update_threshold + c), _mm256_slli_epi32(_mm256_cvttps_epi32(scaled), 1));
+            const int bits = _mm256_movemask_ps(is_background);
+            for (int k = 0; k < 8; k++) {
+                background[c + k] = (bits >> k) & 1 ? 255 : 0;
+            }
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    {
+        const __m128 rate = _mm_set1_ps(params.learning_rate);
+        const __m128 keep = _mm_set1_ps(1 - params.learning_rate);
+        const __m128i req = _mm_set1_epi32(params.req_matches - 1);
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 t_scale = _mm_set1_ps(params.thresh_scale);
+        const __m128 t_min = _mm_set1_ps(params.thresh_min);
+        const __m128 t_max = _mm_set1_ps(params.thresh_max);
+        const __m128 t_inc = _mm_set1_ps(1 + params.thresh_inc_rate);
+        const __m128 t_dec = _mm_set1_ps(1 - params.thresh_dec_rate);
+        const __m128 u_min = _mm_set1_ps(params.update_min);
+        const __m128 u_max = _mm_set1_ps(params.update_max);
+        const __m128 u_inc = _mm_set1_ps(params.update_inc_rate);
+        const __m128 u_dec = _mm_set1_ps(params.update_dec_rate);
+        const __m128 p_scale = _mm_set1_ps(2147483648.0f);
+        const __m128 p_max = _mm_set1_ps(2147483520.0f);
+        const __m128 p_min = _mm_setzero_ps();
+        for (; c + 4 <= cols; c += 4) {
+            int md_bytes, count_bytes;
+            memcpy(&md_bytes, min_dist + c, 4);
+            memcpy(&count_bytes, matches + c, 4);
+            const __m128i md_32 = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(md_bytes), zero), zero);
+            const __m128i count = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(count_bytes), zero), zero);
+            const __m128 dist = _mm_add_ps(_mm_mul_ps(rate, _mm_cvtepi32_ps(md_32)), _mm_mul_ps(keep, _mm_loadu_ps(distance + c)));
+
+            const __m128 thresh = _mm_loadu_ps(threshold + c);
+            const __m128 shrink = _mm_cmpgt_ps(thresh, _mm_mul_ps(dist, t_scale));
+            const __m128 thresh_dec = _mm_max_ps(_mm_mul_ps(thresh, t_dec), t_min);
+            const __m128 thresh_inc = _mm_min_ps(_mm_mul_ps(thresh, t_inc), t_max);
+
+            const __m128 is_background = _mm_castsi128_ps(_mm_cmpgt_epi32(count, req));
+            const __m128 upd = _mm_loadu_ps(update + c);
+            const __m128 upd_dec = _mm_max_ps(_mm_sub_ps(upd, _mm_div_ps(u_dec, dist)), u_min);
+            const __m128 upd_inc = _mm_min_ps(_mm_add_ps(upd, _mm_div_ps(u_inc, dist)), u_max);
+
+            _mm_storeu_ps(distance + c, dist);
+            _mm_storeu_ps(threshold + c, _mm_or_ps(_mm_and_ps(shrink, thresh_dec), _mm_andnot_ps(shrink, thresh_inc)));
+            const __m128 upd_new = _mm_or_ps(_mm_and_ps(is_background, upd_dec), _mm_andnot_ps(is_background, upd_inc));
+            const __m128 scaled = _mm_max_ps(_mm_min_ps(_mm_div_ps(p_scale, upd_new), p_max), p_min);
+            _mm_storeu_ps(update + c, upd_new);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(update_threshold + c), _mm_slli_epi32(_mm_cvttps_epi32(scaled), 1));
+            const int bits = _mm_movemask_ps(is_background);
+            for (int k = 0; k < 4; k++) {
+                background[c + k] = (bits >> k) & 1 ? 255 : 0;
+            }
+        }
+    }
+#endif
+    if (c < cols) {
+        adaptStateRowScalar(min_dist + c, matches + c, cols - c, params, distance + c, threshold + c, update + c, update_threshold + c, background + c);
+    }
+}
+
+/**
+ * Fused step of the simple background subtractor over a row. mask[c] (if
+ * mask is not NULL) is 255 where the difference between input and model is
+ * above threshold and 0 elsewhere, then the model moves towards the
+ * difference by weight/256 and is truncated. With weight rounded from a
+ * learning rate the result is within one of the float blend.
+ */
+inline void blendDifferenceRowScalar(
+        const unsigned char *input,
+        unsigned char *model,
+        const int cols,
+        const int threshold,
+        const int weight,
+        unsigned char *mask) {
+    for (int c = 0; c < cols; c++) {
+        const int diff = abs(static_cast<int>(input[c]) - model[c]);
+        if (mask != NULL) {
+            mask[c] = diff > threshold ? 255 : 0;
+        }
+        model[c] = (model[c] * (256 - weight) + diff * weight) >> 8;
+    }
+}
+
+/**
+ * SIMD version of blendDifferenceRowScalar, returns exactly the same
+ * values. weight has to be within 0 and 256.
+ */
+inline void blendDifferenceRow(
+        const unsigned char *input,
+        unsigned char *model,
+        const int cols,
+        const int threshold,
+        const int weight,
+        unsigned char *mask) {
+    int c = 0;
+    if (threshold < 0 || threshold > 254) {
+        blendDifferenceRowScalar(input, model, cols, threshold, weight, mask);
+        return;
+    }
+#if defined(__AVX2__)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i above = _mm256_set1_epi8(static_cast<char>(threshold + 1));
+        const __m256i keep = _mm256_set1_epi16(static_cast<short>(256 - weight));
+        const __m256i rate = _mm256_set1_epi16(static_cast<short>(weight));
+        for (; c + 32 <= cols; c += 32) {
+            const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + c));
+            const __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(model + c));
+            const __m256i d = _mm256_or_si256(_mm256_subs_epu8(m, v), _mm256_subs_epu8(v, m));
+            if (mask != NULL) {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(mask + c), _mm256_cmpeq_epi8(_mm256_max_epu8(d, above), d));
+            }
+            // prev * (256 - weight) + diff * weight stays below 2^16.
+            const __m256i lo = _mm256_add_epi16(
+                    _mm256_mullo_epi16(_mm256_unpacklo_epi8(m, zero), keep),
+                    _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), rate));
+            const __m256i hi = _mm256_add_epi16(
+                    _mm256_mullo_epi16(_mm256_unpackhi_epi8(m, zero), keep),
+                    _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), rate));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(model + c), _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8)));
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i above = _mm_set1_epi8(static_cast<char>(threshold + 1));
+        const __m128i keep = _mm_set1_epi16(static_cast<short>(256 - weight));
+        const __m128i rate = _mm_set1_epi16(static_cast<short>(weight));
+        for (; c + 16 <= cols; c += 16) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + c));
+            const __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(model + c));
+            const __m128i d = _mm_or_si128(_mm_subs_epu8(m, v), _mm_subs_epu8(v, m));
+            if (mask != NULL) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(mask + c), _mm_cmpeq_epi8(_mm_max_epu8(d, above), d));
+            }
+            const __m128i lo = _mm_add_epi16(
+                    _mm_mullo_epi16(_mm_unpacklo_epi8(m, zero), keep),
+                    _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), rate));
+            const __m128i hi = _mm_add_epi16(
+                    _mm_mullo_epi16(_mm_unpackhi_epi8(m, zero), keep),
+                    _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), rate));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(model + c), _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+        }
+    }
+#endif
+    if (c < cols) {
+        blendDifferenceRowScalar(input + c, model + c, cols - c, threshold, weight, mask == NULL ? NULL : mask + c);
+    }
+}
+
+/**
+ * Sigma-delta step over a row. The background moves one level towards the
+ * input, where the input differs from the new background the variance
+ * moves one level towards amplification times the difference (saturated)
+ * and is clamped to [min_variance, max_variance]. mask[c] (if mask is not
+ * NULL) is 255 where the difference is at least the variance.
+ */
+inline void sigmaDeltaRowScalar(
+        const unsigned char *input,
+        unsigned char *background,
+        unsigned char *variance,
+        const int cols,
+        const int amplification,
+        const int min_variance,
+        const int max_variance,
+        unsigned char *mask) {
+    for (int c = 0; c < cols; c++) {
+        int bg = background[c];
+        if (bg < input[c]) {
+            bg++;
+        } else if (bg > input[c]) {
+            bg--;
+        }
+        const int diff = abs(static_cast<int>(input[c]) - bg);
+
+        int var = variance[c];
+        if (diff != 0) {
+            const int target = diff * amplification < 255 ? diff * amplification : 255;
+            if (var < target) {
+                var++;
+            } else if (var > target) {
+                var--;
+            }
+        }
+        var = var < min_variance ? min_variance : (var > max_variance ? max_variance : var);
+
+        background[c] = bg;
+        variance[c] = var;
+        if (mask != NULL) {
+            mask[c] = diff >= var ? 255 : 0;
+        }
+    }
+}
+
+/**
+ * SIMD version of sigmaDeltaRowScalar, returns exactly the same values.
+ * Variance limits have to be within 0 and 255.
+ */
+inline void sigmaDeltaRow(
+        const unsigned char *input,
+        unsigned char *background,
+        unsigned char *variance,
+        const int cols,
+        const int amplification,
+        const int min_variance,
+        const int max_variance,
+        unsigned char *mask) {
+    int c = 0;
+    if (amplification < 1) {
+        sigmaDeltaRowScalar(input, background, variance, cols, amplification, min_variance, max_variance, mask);
+        return;
+    }
+    // min(x, 1) is the step towards a value that is x levels away.
+#if defined(__AVX2__)
+    {
+        const __m256i one = _mm256_set1_epi8(1);
+        const __m256i var_min = _mm256_set1_epi8(static_cast<char>(min_variance));
+        const __m256i var_max = _mm256_set1_epi8(static_cast<char>(max_variance));
+        for (; c + 32 <= cols; c += 32) {
+            const __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + c));
+            __m256i bg = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(background + c));
+            bg = _mm256_sub_epi8(_mm256_add_epi8(bg, _mm256_min_epu8(_mm256_subs_epu8(in, bg), one)), _mm256_min_epu8(_mm256_subs_epu8(bg, in), one));
+            const __m256i diff = _mm256_or_si256(_mm256_subs_epu8(in, bg), _mm256_subs_epu8(bg, in));
+
+            __m256i target = diff;
+            for (int i = 1; i < amplification; i++) {
+                target = _mm256_adds_epu8(target, diff);
+            }
+            const __m256i changed = _mm256_min_epu8(diff, one);
+            __m256i var = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(variance + c));
+            const __m256i up = _mm256_min_epu8(_mm256_min_epu8(_mm256_subs_epu8(target, var), one), changed);
+            const __m256i down = _mm256_min_epu8(_mm256_min_epu8(_mm256_subs_epu8(var, target), one), changed);
+            var = _mm256_sub_epi8(_mm256_add_epi8(var, up), down);
+            var = _mm256_min_epu8(_mm256_max_epu8(var, var_min), var_max);
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(background + c), bg);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(variance + c), var);
+            if (mask != NULL) {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(mask + c), _mm256_cmpeq_epi8(_mm256_max_epu8(diff, var), diff));
+            }
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    {
+        const __m128i one = _mm_set1_epi8(1);
+        const __m128i var_min = _mm_set1_epi8(static_cast<char>(min_variance));
+        const __m128i var_max = _mm_set1_epi8(static_cast<char>(max_variance));
+        for (; c + 16 <= cols; c += 16) {
+            const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + c));
+            __m128i bg = _mm_loadu_si128(reinterpret_cast<const __m128i*>(background + c));
+            bg = _mm_sub_epi8(_mm_add_epi8(bg, _mm_min_epu8(_mm_subs_epu8(in, bg), one)), _mm_min_epu8(_mm_subs_epu8(bg, in), one));
+            const __m128i diff = _mm_or_si128(_mm_subs_epu8(in, bg), _mm_subs_epu8(bg, in));
+
+            __m128i target = diff;
+            for (int i = 1; i < amplification; i++) {
+                target = _mm_adds_epu8(target, diff);
+            }
+            const __m128i changed = _mm_min_epu8(diff, one);
+            __m128i var = _mm_loadu_si128(reinterpret_cast<const __m128i*>(variance + c));
+            const __m128i up = _mm_min_epu8(_mm_min_epu8(_mm_subs_epu8(target, var), one), changed);
+            const __m128i down = _mm_min_epu8(_mm_min_epu8(_mm_subs_epu8(var, target), one), changed);
+            var = _mm_sub_epi8(_mm_add_epi8(var, up), down);
+            var = _mm_min_epu8(_mm_max_epu8(var, var_min), var_max);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(background + c), bg);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(variance + c), var);
+            if (mask != NULL) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(mask + c), _mm_cmpeq_epi8(_mm_max_epu8(diff, var), diff));
+            }
+        }
+    }
+#endif
+    if (c < cols) {
+        sigmaDeltaRowScalar(input + c, background + c, variance + c, cols - c, amplification, min_variance, max_variance, mask == NULL ? NULL : mask + c);
+    }
+}
+
+#endif //BSUB_KERNELS_H
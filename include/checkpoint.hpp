@@ -0,0 +1,269 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+#include <opencv2/core/core.hpp>
+
+/**
+ * Binary checkpoints of the subtractor state.
+ *
+ * A checkpoint file is a header, the data blocks and a table describing
+ * the blocks:
+ *
+ *   CheckpointHeader    magic, version, block count, table offset
+ *   blocks              raw data, every block starts on a 64 byte boundary
+ *   CheckpointBlock[]   name, matrix type, size and offset of every block
+ *
+ * Blocks hold the data exactly as it is in memory, in native byte order, so
+ * the reader maps the file and copies blocks straight into the models
+ * without parsing anything. Built with USE_ZLIB the writer can deflate
+ * large blocks, those are inflated on load instead.
+ *
+ * Names are grouped with beginGroup() and endGroup(), block "MODEL" written
+ * in group "HOFSUB" is found as "HOFSUB/MODEL".
+ *
+ * Data that only grows, like the per frame results, goes to an append only
+ * log next to the checkpoint (<checkpoint>.log) instead of a block. Every
+ * checkpoint only adds what is new to the log and stores how many bytes of
+ * the log it covers, anything after that is dropped on the next save.
+ */
+
+static const char CHECKPOINT_MAGIC[8] = {'W', 'B', 'S', 'C', 'K', 'P', 'T', '\0'};
+static const uint32_t CHECKPOINT_VERSION = 1;
+
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_count;
+    uint64_t table_offset;
+    uint64_t file_size;
+    // Bytes of the log that belong to the checkpoint, 0 without a log
+    uint64_t log_size;
+    unsigned char reserved[24];
+};
+
+struct CheckpointBlock {
+    enum Flags {
+        DEFLATED = 1
+    };
+
+    char name[64];
+    // OpenCV matrix type and size of the data
+    int32_t type;
+    int32_t rows;
+    int32_t cols;
+    uint32_t flags;
+    uint64_t offset;
+    // Bytes in the file and bytes of the data, they differ when deflated
+    uint64_t stored_size;
+    uint64_t size;
+    unsigned char reserved[24];
+};
+
+/**
+ * Writes a binary checkpoint. The blocks are only copied into memory, the
+ * file is written by save() or close(). That keeps taking a snapshot cheap
+ * enough for the frame loop while another thread saves it, see
+ * CheckpointSaver.
+ *
+ * Everything goes to a temporary file that is synced and only then replaces
+ * the checkpoint, a crash never leaves a partial checkpoint behind.
+ */
+class CheckpointWriter {
+public:
+    /**
+     * Without a filename the snapshot stays in memory until save().
+     */
+    CheckpointWriter(const std::string &filename = std::string(), const bool compress = false);
+    ~CheckpointWriter();
+
+    bool isOpened() const;
+
+    /**
+     * Drops every block, the memory is reused by the next snapshot.
+     */
+    void clear();
+
+    void beginGroup(const std::string &name);
+    void endGroup();
+
+    void write(const std::string &name, const cv::Mat &mat);
+    void write(const std::string &name, const int value);
+    void write(const std::string &name, const double value);
+    /**
+     * Block of raw bytes, read back with the matching read().
+     */
+    void write(const std::string &name, const void *data, const size_t size);
+
+    /**
+     * Bytes of the log from offset on, the log is cut at offset and they are
+     * appended by save(). The log of the checkpoint ends after them.
+     */
+    void log(const uint64_t offset, const void *data, const size_t size);
+
+    /**
+     * Writes the log and then the snapshot to filename, false when anything went wrong on
+     * the way. The blocks are kept and may be saved again.
+     */
+    bool save(const std::string &filename);
+
+    /**
+     * Saves to the filename given to the constructor.
+     */
+    bool close();
+
+private:
+    static const int ALIGNMENT = 64;
+    // Smaller blocks are never deflated
+    static const size_t MIN_DEFLATE_SIZE = 4096;
+
+    std::string filename;
+    bool compress;
+    bool failed;
+    bool closed;
+
+    std::string prefix;
+    std::vector<size_t> group_lengths;
+    // Blocks with their offsets into data, the copy in table gets the
+    // offsets in the file
+    std::vector<CheckpointBlock> blocks;
+    std::vector<unsigned char> data;
+    std::vector<CheckpointBlock> table;
+    std::vector<unsigned char> deflated;
+
+    bool has_log;
+    uint64_t log_offset;
+    std::vector<unsigned char> log_data;
+
+    void addBlock(const std::string &name, const int type, const int rows, const int cols, const void *data, const size_t size);
+    bool saveLog(const std::string &filename);
+    static bool pad(FILE *file, size_t &position);
+    static bool writeAligned(FILE *file, const void *data, const size_t size, size_t &position);
+    static bool syncFile(const int fd);
+    static void syncDirectory(const std::string &filename);
+};
+
+/**
+ * Saves checkpoints in a background thread.
+ *
+ * The frame loop fills the writer returned by snapshot() and hands it over
+ * with save(), that only copies the state, the thread writes and syncs the
+ * file while the next frames are processed. There are two writers, one can
+ * be filled while the other is saved. finished() tells when the thread is
+ * done with a snapshot and whether it made it to the disk.
+ */
+class CheckpointSaver {
+public:
+    CheckpointSaver(const std::string &filename, const bool compress = false);
+    /**
+     * Finishes the snapshot that was handed over.
+     */
+    ~CheckpointSaver();
+
+    /**
+     * Empty writer for the next snapshot, NULL while both writers are busy.
+     */
+    CheckpointWriter* snapshot();
+    /**
+     * Hands the writer returned by snapshot() to the thread.
+     */
+    void save();
+
+    /**
+     * True once the thread is done with the snapshots handed over since the
+     * last call, saved tells whether the last of them made it to the disk.
+     */
+    bool finished(bool &saved);
+    /**
+     * Whether a snapshot is still waiting for the disk.
+     */
+    bool busy();
+    /**
+     * Blocks until the thread is done, false when the last save failed.
+     */
+    bool wait();
+
+private:
+    std::string filename;
+    CheckpointWriter writers[2];
+    // Writer being filled, handed over and being saved, -1 for none
+    int filling;
+    int pending;
+    int saving;
+    bool stopping;
+    bool failed;
+    long finished_count;
+    long reported_count;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable work;
+    std::condition_variable done;
+
+    void run();
+};
+
+/**
+ * Reads a binary checkpoint through a read only memory mapping of the file.
+ */
+class CheckpointReader {
+public:
+    CheckpointReader(const std::string &filename);
+    ~CheckpointReader();
+
+    bool isOpened() const;
+
+    void beginGroup(const std::string &name);
+    void endGroup();
+
+    bool has(const std::string &name) const;
+
+    /**
+     * Copies a block into the matrix, false when it is missing.
+     */
+    bool read(const std::string &name, cv::Mat &mat) const;
+    bool read(const std::string &name, int &value) const;
+    bool read(const std::string &name, bool &value) const;
+    bool read(const std::string &name, float &value) const;
+    bool read(const std::string &name, double &value) const;
+    /**
+     * Copies a raw block, false when it is missing or not size bytes long.
+     */
+    bool read(const std::string &name, void *data, const size_t size) const;
+
+    /**
+     * Bytes of the log that belong to the checkpoint.
+     */
+    uint64_t logSize() const;
+    /**
+     * Copies the first size bytes of the log, false when the log is
+     * shorter.
+     */
+    bool readLog(void *data, const size_t size) const;
+
+private:
+    std::string log_filename;
+    const unsigned char *mapping;
+    size_t mapping_size;
+    // Whole file when it could not be mapped
+    std::vector<unsigned char> buffer;
+
+    const CheckpointHeader *header;
+    const CheckpointBlock *blocks;
+
+    std::string prefix;
+    std::vector<size_t> group_lengths;
+
+    bool validate();
+    const CheckpointBlock* find(const std::string &name) const;
+    bool copyBlock(const CheckpointBlock &block, void *data) const;
+    void unmap();
+};
+
+#endif //CHECKPOINT_H
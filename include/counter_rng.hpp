@@ -0,0 +1,73 @@
+#ifndef COUNTER_RNG_H
+#define COUNTER_RNG_H
+
+#include <stdint.h>
+
+/**
+ * Counter based random number generator (SplitMix64 indexed by position).
+ *
+ * A draw is a pure function of (seed, frame, pixel, draw) so there is no
+ * generator state to save in a checkpoint or to replay on resume.
+ */
+class CounterRNG {
+public:
+    /** Frame index reserved for draws made while initiating a model. */
+    static const uint32_t INIT_FRAME = 0xFFFFFFFFu;
+    /** Number of independent draws available per pixel and frame. */
+    static const uint32_t MAX_DRAWS = 64;
+
+    CounterRNG(const uint32_t seed = 0) {
+        this->key = mix(seed);
+    }
+
+    /**
+     * 64 random bits for the given coordinates, pixel has to be smaller
+     * than 2^26 and draw smaller than MAX_DRAWS.
+     */
+    inline uint64_t operator()(const uint32_t frame, const uint32_t pixel, const uint32_t draw) const {
+        const uint64_t counter = (static_cast<uint64_t>(frame) << 32) | (static_cast<uint64_t>(pixel) << 6) | draw;
+        return mix(this->key + counter * GAMMA);
+    }
+
+    /**
+     * Maps 32 random bits onto [0, n).
+     */
+    static inline int uniform(const uint32_t bits, const int n) {
+        return static_cast<int>((static_cast<uint64_t>(bits) * n) >> 32);
+    }
+
+    /**
+     * Maps 32 random bits onto [0, 1).
+     */
+    static inline float uniformReal(const uint32_t bits) {
+        return (bits >> 8) * (1.0f / 16777216.0f);
+    }
+
+    /**
+     * Threshold on 32 random bits, bits < threshold holds with probability
+     * 1/n. n at or below 1 is (nearly) always.
+     */
+    static inline uint32_t inverseThreshold(const float n) {
+        // Computed on 31 bits so the SIMD kernels can reproduce it with a
+        // signed conversion.
+        // Largest float below 2^31
+        const float max_scaled = 2147483520.0f;
+        float scaled = 2147483648.0f / n;
+        scaled = scaled < max_scaled ? scaled : max_scaled;
+        scaled = scaled > 0 ? scaled : 0;
+        return static_cast<uint32_t>(static_cast<int32_t>(scaled)) << 1;
+    }
+
+    static inline uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+private:
+    static const uint64_t GAMMA = 0x9E3779B97F4A7C15ull;
+
+    uint64_t key;
+};
+
+#endif //COUNTER_RNG_H
@@ -0,0 +1,65 @@
+#ifndef FOREGROUND_STATS_H
+#define FOREGROUND_STATS_H
+
+#include <algorithm>
+#include <climits>
+#include <opencv2/core/core.hpp>
+
+/**
+ * Foreground statistics of a frame. The subtractors gather them while
+ * classifying, so no mask has to be built or post-processed.
+ */
+struct ForegroundStats {
+    // Number of foreground pixels
+    int count;
+    // Number of pixels classified
+    int total;
+    // Inclusive bounding box of the foreground pixels
+    int top;
+    int left;
+    int bottom;
+    int right;
+
+    ForegroundStats(const int total = 0) {
+        reset(total);
+    }
+
+    inline void reset(const int total = 0) {
+        this->count = 0;
+        this->total = total;
+        this->top = INT_MAX;
+        this->left = INT_MAX;
+        this->bottom = -1;
+        this->right = -1;
+    }
+
+    inline void add(const int r, const int c) {
+        this->count++;
+        this->top = std::min(this->top, r);
+        this->bottom = std::max(this->bottom, r);
+        this->left = std::min(this->left, c);
+        this->right = std::max(this->right, c);
+    }
+
+    inline void add(const ForegroundStats &other) {
+        this->count += other.count;
+        this->total += other.total;
+        this->top = std::min(this->top, other.top);
+        this->bottom = std::max(this->bottom, other.bottom);
+        this->left = std::min(this->left, other.left);
+        this->right = std::max(this->right, other.right);
+    }
+
+    inline double fraction() const {
+        return this->total > 0 ? static_cast<double>(this->count) / this->total : 0;
+    }
+
+    inline cv::Rect bounds() const {
+        if (this->count == 0) {
+            return cv::Rect();
+        }
+        return cv::Rect(this->left, this->top, this->right - this->left + 1, this->bottom - this->top + 1);
+    }
+};
+
+#endif //FOREGROUND_STATS_H
@@ -2,10 +2,13 @@
 #define HOFSUB_H
 
 #include <vector>
-#include <random>
 #include "bsub.hpp"
-
-#include "boost/random.hpp"
+#include "sample_model.hpp"
+#include "pixel_state.hpp"
+#include "counter_rng.hpp"
+#include "random_table.hpp"
+#include "row_band.hpp"
+#include "thread_pool.hpp"
 
 /**
  * van_2014_vibe background subtraction class.
@@ -17,15 +20,28 @@ public:
         const int cols = 0,
         const int threshold = 20,
         const int colors = 256,
-        const int history = 20);
+        const int history = 20,
+        const int layout = SampleModel::INTERLEAVED,
+        const int threads = 1,
+        const int precision = PixelState::FLOAT);
     HOFSub(const HOFSub &other);
     ~HOFSub();
     void operator()(cv::InputArray image, cv::OutputArray fgmask, double learning_rate);
     void apply(cv::InputArray image, cv::OutputArray fgmask, double learning_rate = 0);
+    void applyStats(cv::InputArray image, ForegroundStats &stats, double learning_rate = 0);
+    void maintain(cv::InputArray image, double learning_rate = 0);
     void getBackgroundImage(cv::OutputArray background_image) const;
     std::ostream& print(std::ostream &out) const;
     void read(const cv::FileNode &node);
     void write(cv::FileStorage &fs) const;
+    bool readBinary(CheckpointReader &reader);
+    void writeBinary(CheckpointWriter &writer) const;
+
+    /**
+     * Number of horizontal bands processed in parallel. The output is
+     * reproducible for a given seed and number of threads.
+     */
+    void setThreads(const int threads);
 
 private:
     static const int REQ_MATCHES = 2;
@@ -50,21 +66,50 @@ private:
     float color_expansion;
     bool initiated;
 
-    cv::Ptr<cv::Mat> model;
-    cv::Ptr<cv::Mat> decision_distance;
-    cv::Ptr<cv::Mat> threshold;
-    cv::Ptr<cv::Mat> update_val;
+    cv::Ptr<SampleModel> model;
+    cv::Ptr<PixelState> state;
     cv::Ptr<cv::Mat> background_image;
 
-    double seed;
-    double num_generated;
-    std::mt19937 *gen;
-    boost::random::uniform_real_distribution<float> *update;
-    boost::random::uniform_int_distribution<int> *history_update;
-    boost::random::uniform_int_distribution<int> *pick_neighbor;
+    int seed;
+    int frame;
+    CounterRNG rng;
+    RandomTable table;
+
+    int threads;
+    std::vector<RowBand> bands;
+    // Mask of the last apply and the buffers of its post-processing, reused
+    // between frames
+    cv::Mat mask_buffer;
+    cv::Mat smoothed_mask;
+    std::vector<std::vector<cv::Point> > contours;
+    std::vector<cv::Vec4i> hierarchy;
+    std::vector<std::vector<cv::Point> > hulls;
+    cv::Ptr<ThreadPool> pool;
+
+    // Arguments of the running classify() for the band tasks
+    const cv::Mat *band_image;
+    cv::Mat *band_mask;
+    double band_learning_rate;
+    bool band_all_background;
 
     void initiateModel(cv::Mat &image, cv::Rect &random_init);
-    void updateModel(const int &r, const int &c, const unsigned char &val, const bool &update_neighbor = true);
+    /**
+     * With all_background set no pixel is classified and the adaptive state
+     * is left alone, all active pixels update the model like background
+     * pixels.
+     */
+    void classify(cv::InputArray image, cv::Mat *mask, double learning_rate, const bool all_background = false);
+    void applyBand(const cv::Mat &input_image, cv::Mat *mask, const double &learning_rate, RowBand &band);
+    void maintainBand(const cv::Mat &input_image, RowBand &band);
+    /**
+     * Apply the neighbour updates of a row, the ones landing in another
+     * band wait until all bands are done.
+     */
+    void flushRow(RowBand &band);
+    template<typename T>
+    void applyRows(const cv::Mat &input_image, cv::Mat *mask, const double &learning_rate, RowBand &band);
+    void updateModel(const int &r, const int &c, const unsigned char &val, const int &i, RowBand &band);
+    bool updateSample(const int &r, const int &c, const unsigned char &val, const uint32_t &update, const int &slot);
 };
 
 static void write(cv::FileStorage &fs, const std::string&, const HOFSub &x) {
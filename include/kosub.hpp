@@ -4,22 +4,49 @@
 #include "bsub.hpp"
 
 #include <cmath>
+#include <vector>
+#include <stdint.h>
 
 /**
  * Ko_2008_Background background subtraction class.
+ *
+ * The color densities of every pixel are kept densely as float or 16 bit
+ * weights, or as the strongest few bins of every pixel. The representation
+ * is the most accurate one that fits the memory limit given on
+ * construction.
  */
 class KOSub : public BSub {
 public:
+    enum Representation {
+        DENSE = 0,
+        DENSE_16 = 1,
+        TOP_BINS = 2
+    };
+
+    /**
+     * A memory_limit of zero (bytes) always keeps the dense float model.
+     */
     KOSub(
         const int rows,
         const int cols,
         const int colors = 256,
-        const int radius = 5);
+        const int radius = 5,
+        const size_t memory_limit = 0);
     ~KOSub();
     void operator()(cv::InputArray image, cv::OutputArray fgmask, double learning_rate);
     void apply(cv::InputArray image, cv::OutputArray fgmask, double learning_rate = 0);
+    void applyStats(cv::InputArray image, ForegroundStats &stats, double learning_rate = 0);
     void getBackgroundImage(cv::OutputArray background_image) const;
 
+    int getRepresentation() const;
+    /** Bins per pixel of the TOP_BINS representation. */
+    int getBins() const;
+
+    /**
+     * Bytes of density model for the given representation.
+     */
+    static size_t modelSize(const int rows, const int cols, const int colors, const int representation, const int bins = 0);
+
 private:
     const static int max_colors = 256;
 
@@ -31,24 +58,81 @@ private:
     float color_reduction;
     float color_expansion;
 
+    int representation;
+    int bins;
+
+    // Dense densities, rows x cols x colors of CV_32F or CV_16U
     cv::Mat *model;
+    // Strongest bins per pixel, rows x (cols * bins) colors and weights
+    cv::Mat bin_colors;
+    cv::Mat bin_weights;
+    // Colors held by the bins of the current pixel and the colors that were
+    // marked in in_bins
+    std::vector<unsigned char> in_bins;
+    std::vector<unsigned char> marked_colors;
     cv::Mat *diff;
     cv::Mat *background_image;
 
-    inline float densityNeighborhood(cv::Mat &image, const int row, const int col, const int color, const int radius) {
-        const int row_start = std::max(row - radius, 0);
-        const int col_start = std::max(col - radius, 0);
-        const int row_end = std::min(row + radius, image.rows);
-        const int col_end = std::min(col + radius, image.cols);
-
-        float density = 0;
-        for (int r = row_start; r < row_end; r++) {
-            unsigned char *p = image.ptr<unsigned char>(r);
-            for (int c = col_start; c < col_end; c++) {
-                density += (color == floor(this->color_reduction * p[c]));
-            }
+    void classify(cv::InputArray image, const double &learning_rate, ForegroundStats *stats);
+
+    /**
+     * Blend the window densities into the model of a pixel. Returns the
+     * correlation of the densities with the previous model and sets the
+     * background color.
+     */
+    float updateDense(const int r, const int c, const double &learning_rate, const float &window_area, unsigned char &bg_color);
+    float updateDense16(const int r, const int c, const double &learning_rate, const float &window_area, unsigned char &bg_color);
+    float updateTopBins(const int r, const int c, const double &learning_rate, const float &window_area, unsigned char &bg_color);
+
+    static inline float decodeWeight(const uint16_t weight) {
+        return weight * (1.0f / 65535);
+    }
+
+    static inline uint16_t encodeWeight(const float density) {
+        return cv::saturate_cast<uint16_t>(density * 65535);
+    }
+
+    /**
+     * Encoded blend of a weight with a density. Rounding alone keeps small
+     * weights where they are, so a weight that has to shrink loses at least
+     * one step and colors that are gone reach zero.
+     */
+    static inline uint16_t blendWeight(const uint16_t weight, const float density, const double &learning_rate) {
+        const float prev_val = decodeWeight(weight);
+        const uint16_t blended = encodeWeight(((1-learning_rate) * prev_val) + (learning_rate * density));
+        if (blended >= weight && weight > 0 && learning_rate > 0 && density < prev_val) {
+            return weight - 1;
+        }
+        return blended;
+    }
+
+    // Pixel values mapped to their color bin
+    unsigned char quantize[max_colors];
+    cv::Mat quantized;
+    // Per column and color, pixel count of the rows inside the window
+    std::vector<int> column_counts;
+    // Per color, pixel count of the window around the current pixel
+    std::vector<int> window_counts;
+
+    /**
+     * Adds (sign 1) or removes (sign -1) a row of the quantized frame from
+     * the column counts.
+     */
+    inline void countRow(const int r, const int sign) {
+        const unsigned char *p = this->quantized.ptr<unsigned char>(r);
+        for (int c = 0; c < this->quantized.cols; c++) {
+            this->column_counts[c * this->colors + p[c]] += sign;
+        }
+    }
+
+    /**
+     * Adds (sign 1) or removes (sign -1) a column of counts from the window.
+     */
+    inline void countColumn(const int c, const int sign) {
+        const int *counts = &this->column_counts[c * this->colors];
+        for (int z = 0; z < this->colors; z++) {
+            this->window_counts[z] += sign * counts[z];
         }
-        return density / (radius * radius * 4);
     }
 };
 
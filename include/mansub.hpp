@@ -0,0 +1,71 @@
+#ifndef MANSUB_H
+#define MANSUB_H
+
+#include <vector>
+#include "bsub.hpp"
+
+/**
+ * manzanera_2007_sigma_delta background subtraction class.
+ *
+ * Every frame the background moves one gray level towards the input and
+ * the variance one level towards a multiple of the difference, all in 8 bit
+ * integers. Pixels differing by at least the variance are foreground. The
+ * learning rate is not used.
+ */
+class MANSub : public BSub {
+public:
+    MANSub(
+        const int rows = 0,
+        const int cols = 0,
+        const int amplification = 2,
+        const int min_variance = 2,
+        const int max_variance = 255);
+    MANSub(const MANSub &other);
+    ~MANSub();
+    void operator()(cv::InputArray image, cv::OutputArray fgmask, double learning_rate);
+    void apply(cv::InputArray image, cv::OutputArray fgmask, double learning_rate = 0);
+    void applyStats(cv::InputArray image, ForegroundStats &stats, double learning_rate = 0);
+    void getBackgroundImage(cv::OutputArray background_image) const;
+    std::ostream& print(std::ostream &out) const;
+    void read(const cv::FileNode &node);
+    void write(cv::FileStorage &fs) const;
+    bool readBinary(CheckpointReader &reader);
+    void writeBinary(CheckpointWriter &writer) const;
+
+private:
+    int rows;
+    int cols;
+    int amplification;
+    int min_variance;
+    int max_variance;
+
+    bool initiated;
+
+    // The background lives in BSub::model
+    cv::Ptr<cv::Mat> variance;
+
+    // Reused between frames so a frame allocates nothing
+    cv::Mat gray;
+    std::vector<unsigned char> row_mask;
+
+    void classify(cv::InputArray image, cv::Mat *mask, ForegroundStats *stats);
+};
+
+static void write(cv::FileStorage &fs, const std::string&, const MANSub &x) {
+    x.write(fs);
+}
+
+static void read(const cv::FileNode &node, MANSub &x, const MANSub &default_value = MANSub()) {
+    if (node.empty()) {
+        x = default_value;
+    } else {
+        x.read(node);
+    }
+}
+
+static std::ostream& operator<<(std::ostream &out, const MANSub &x) {
+    x.print(out);
+    return out;
+}
+
+#endif //MANSUB_H
@@ -0,0 +1,175 @@
+#ifndef PIXEL_STATE_H
+#define PIXEL_STATE_H
+
+#include <cmath>
+#include <cstddef>
+#include <stdint.h>
+#include <opencv2/core/core.hpp>
+
+#include "counter_rng.hpp"
+
+/**
+ * Adaptive per pixel state of HOFSub (decision distance, threshold and
+ * update value).
+ *
+ * Every image row is one 64 byte aligned block holding the row of each
+ * field one after another, so the fused classify and update pass streams
+ * three adjacent arrays instead of three separate images. Values are
+ * stored as float or, with FIXED precision, as unsigned 16 bit fixed point
+ * which halves the memory.
+ *
+ * Each row also holds the update value as a threshold on 32 random bits
+ * (see CounterRNG::inverseThreshold), so deciding on a model update is one
+ * integer compare. set(), fill() and fromMat() keep it in sync, code that
+ * writes UPDATE rows directly has to write the thresholds as well.
+ *
+ * FIXED keeps distances as 8.8 and thresholds as 11.5 fixed point. The
+ * thresholds saturate at maxValue(THRESHOLD), 2048, which is above anything
+ * HOFSub reaches from 8 bit distances (255 * THRESH_SCALE plus one
+ * increment). The update values change by as little as UPDATE_DEC_RATE / 255
+ * per frame, below any 16 bit step over their range, so FIXED has no UPDATE
+ * row and keeps them only as their 32 bit thresholds.
+ *
+ * Rows -1 to rows and columns -1 to cols exist so neighbour lookups need
+ * no bounds checks.
+ */
+class PixelState {
+public:
+    enum Precision {
+        FLOAT = 0,
+        FIXED = 1
+    };
+
+    enum Field {
+        DISTANCE = 0,
+        THRESHOLD = 1,
+        UPDATE = 2
+    };
+
+    static const int NUM_FIELDS = 3;
+
+    PixelState(const int rows = 0, const int cols = 0, const int precision = FLOAT);
+
+    int getRows() const;
+    int getCols() const;
+    int getPrecision() const;
+    bool empty() const;
+
+    /**
+     * Row r of a field, T has to be float for FLOAT and uint16_t for FIXED.
+     * FIXED has no UPDATE row, see decodeUpdate().
+     */
+    template<typename T>
+    inline T* row(const int field, const int r) const {
+        return reinterpret_cast<T*>(this->origin + r * this->row_step + field * this->field_step);
+    }
+
+    /**
+     * Update thresholds of row r.
+     */
+    inline uint32_t* updateThresholdRow(const int r) const {
+        return reinterpret_cast<uint32_t*>(this->origin + r * this->row_step + this->stored_fields * this->field_step);
+    }
+
+    inline uint32_t updateThreshold(const int r, const int c) const {
+        return updateThresholdRow(r)[c];
+    }
+
+    inline float get(const int field, const int r, const int c) const {
+        if (this->precision == FIXED) {
+            if (field == UPDATE) {
+                return decodeUpdate(updateThreshold(r, c));
+            }
+            return decode(row<uint16_t>(field, r)[c], field);
+        }
+        return row<float>(field, r)[c];
+    }
+
+    inline void set(const int field, const int r, const int c, const float value) {
+        if (this->precision == FIXED) {
+            if (field != UPDATE) {
+                encode(row<uint16_t>(field, r)[c], value, field);
+            }
+        } else {
+            row<float>(field, r)[c] = value;
+        }
+        if (field == UPDATE) {
+            updateThresholdRow(r)[c] = CounterRNG::inverseThreshold(value);
+        }
+    }
+
+    /**
+     * Largest value a field can hold.
+     */
+    float maxValue(const int field) const;
+
+    /**
+     * Sets a field everywhere, border included.
+     */
+    void fill(const int field, const float value);
+
+    /**
+     * Copy a field from/to a rows x cols CV_32F matrix, the layout used in
+     * checkpoints. fromMat() leaves the field alone and returns false when
+     * the matrix does not fit.
+     */
+    void toMat(const int field, cv::Mat &output) const;
+    bool fromMat(const int field, const cv::Mat &input);
+
+    /**
+     * The state as stored, border and padding included. Binary checkpoints
+     * keep this block as is, it only fits a state with the same size and
+     * precision.
+     */
+    unsigned char* data() const;
+    size_t dataSize() const;
+
+    static inline float decode(const float value, const int) {
+        return value;
+    }
+
+    static inline float decode(const uint16_t value, const int field) {
+        return value * FIXED_SCALE[field];
+    }
+
+    static inline void encode(float &out, const float value, const int) {
+        out = value;
+    }
+
+    static inline void encode(uint16_t &out, const float value, const int field) {
+        const float scaled = value * FIXED_ONE[field] + 0.5f;
+        out = scaled >= 65535.0f ? 65535 : (scaled > 0 ? static_cast<uint16_t>(scaled) : 0);
+    }
+
+    /**
+     * Update value of an update threshold, values at or below 1 come back
+     * as 1.
+     */
+    static inline float decodeUpdate(const uint32_t threshold) {
+        const uint32_t scaled = threshold >> 1;
+        return scaled > 0 ? 2147483648.0f / scaled : 2147483648.0f;
+    }
+
+private:
+    static const int ALIGNMENT = 64;
+    // Bytes in front of every field row, keeps column 0 aligned
+    static const int BORDER = ALIGNMENT;
+    // Fixed point value of 1 and its inverse of DISTANCE and THRESHOLD
+    static const float FIXED_ONE[UPDATE];
+    static const float FIXED_SCALE[UPDATE];
+
+    int rows;
+    int cols;
+    int precision;
+    // Field rows stored per image row
+    int stored_fields;
+
+    ptrdiff_t field_step;
+    ptrdiff_t row_step;
+
+    cv::Mat storage;
+    // Field 0 of pixel (0, 0)
+    unsigned char *origin;
+};
+
+#endif //PIXEL_STATE_H
@@ -0,0 +1,84 @@
+#ifndef RANDOM_TABLE_H
+#define RANDOM_TABLE_H
+
+#include <vector>
+#include "counter_rng.hpp"
+
+/**
+ * Pre-drawn random decisions for the ViBe style model update.
+ *
+ * The table is refilled in bulk from a CounterRNG at the start of every
+ * frame and each row reads it from a random offset, so the hot path is a
+ * table lookup while a decision stays a pure function of (seed, frame, pixel).
+ */
+class RandomTable {
+public:
+    static const int DEFAULT_SIZE = 8192;
+
+    RandomTable(const uint32_t seed = 0, const int cols = 0, const int history = 1, const int size = DEFAULT_SIZE);
+
+    /**
+     * Draw the decisions of the given frame.
+     */
+    void fill(const uint32_t frame);
+
+    /**
+     * Index of the first entry used by row r, pixel c uses rowOffset(r) + c.
+     */
+    inline int rowOffset(const int r) const {
+        return CounterRNG::uniform(static_cast<uint32_t>(this->rng(this->frame, r, ROW_DRAW)), this->size);
+    }
+
+    /** 32 random bits deciding on the update of the pixel. */
+    inline uint32_t update(const int i) const {
+        return this->updates[i];
+    }
+
+    /** History slot replaced by the pixel. */
+    inline int slot(const int i) const {
+        return this->decisions[i].slot;
+    }
+
+    /** Row offset (-1 to 1) of the neighbour picked for propagation. */
+    inline int neighborRow(const int i) const {
+        return this->decisions[i].neighbor_row;
+    }
+
+    /** Column offset (-1 to 1) of the neighbour picked for propagation. */
+    inline int neighborCol(const int i) const {
+        return this->decisions[i].neighbor_col;
+    }
+
+    /** 32 random bits deciding on the update of the neighbour. */
+    inline uint32_t neighborUpdate(const int i) const {
+        return this->decisions[i].neighbor_update;
+    }
+
+    /** History slot replaced in the neighbour. */
+    inline int neighborSlot(const int i) const {
+        return this->decisions[i].neighbor_slot;
+    }
+
+private:
+    static const uint32_t ROW_DRAW = 2;
+
+    // Decisions only needed once an update has been accepted.
+    struct Decision {
+        uint32_t neighbor_update;
+        unsigned char slot;
+        unsigned char neighbor_slot;
+        signed char neighbor_row;
+        signed char neighbor_col;
+    };
+
+    CounterRNG rng;
+    uint32_t frame;
+    int cols;
+    int history;
+    int size;
+
+    std::vector<uint32_t> updates;
+    std::vector<Decision> decisions;
+};
+
+#endif //RANDOM_TABLE_H
@@ -0,0 +1,110 @@
+#ifndef ROW_BAND_H
+#define ROW_BAND_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "foreground_stats.hpp"
+
+/**
+ * Buffer i of a set of row buffers, created or grown to cols values on first
+ * use and kept afterwards.
+ */
+template<typename T>
+inline T* scratchRow(std::vector<std::vector<T> > &rows, const size_t i, const int cols) {
+    if (rows.size() <= i) {
+        rows.resize(i + 1);
+    }
+    if (rows[i].size() < static_cast<size_t>(cols)) {
+        rows[i].resize(cols);
+    }
+    return rows[i].data();
+}
+
+/**
+ * Neighbour update held back until the end of the row or, when it lands in
+ * another band, until every band of the frame is done.
+ */
+struct DeferredUpdate {
+    int r;
+    int c;
+    unsigned char val;
+    uint32_t update;
+    int slot;
+};
+
+/**
+ * Horizontal band of rows processed by a single thread. Neighbour updates
+ * are batched per row, the ones that land outside of the band are deferred
+ * so bands never write to rows another thread may be reading.
+ */
+struct RowBand {
+    int row_start;
+    int row_end;
+    // Neighbour updates of the row being processed
+    std::vector<DeferredUpdate> batch;
+    // Neighbour updates landing in other bands
+    std::vector<DeferredUpdate> deferred;
+    // Foreground pixels of the band in the last frame
+    ForegroundStats stats;
+    // Per row working buffers, reused from frame to frame
+    std::vector<std::vector<unsigned char> > byte_rows;
+    std::vector<std::vector<float> > float_rows;
+
+    inline bool contains(const int r) const {
+        return r >= this->row_start && r < this->row_end;
+    }
+
+    inline void add(const int r, const int c, const unsigned char val, const uint32_t update, const int slot) {
+        DeferredUpdate d;
+        d.r = r;
+        d.c = c;
+        d.val = val;
+        d.update = update;
+        d.slot = slot;
+        this->batch.push_back(d);
+    }
+
+    /**
+     * Room for the neighbour updates of rows of the given width. A pixel
+     * updates at most one neighbour and only the first and last row of a
+     * band reach outside of it, so a frame never has to grow the batches.
+     */
+    inline void reserve(const int cols) {
+        this->batch.reserve(cols);
+        this->deferred.reserve(2 * cols);
+    }
+
+    inline unsigned char* byteRow(const size_t i, const int cols) {
+        return scratchRow(this->byte_rows, i, cols);
+    }
+
+    inline float* floatRow(const size_t i, const int cols) {
+        return scratchRow(this->float_rows, i, cols);
+    }
+};
+
+/**
+ * Foreground statistics of all bands combined.
+ */
+inline void mergeStats(const std::vector<RowBand> &bands, ForegroundStats &stats) {
+    stats.reset();
+    for (size_t i = 0; i < bands.size(); i++) {
+        stats.add(bands[i].stats);
+    }
+}
+
+/**
+ * Split rows into the given number of bands of (almost) equal height.
+ */
+inline std::vector<RowBand> splitRows(const int rows, const int bands) {
+    const int num_bands = bands < 1 ? 1 : bands;
+    std::vector<RowBand> split(num_bands);
+    for (int i = 0; i < num_bands; i++) {
+        split[i].row_start = (rows * i) / num_bands;
+        split[i].row_end = (rows * (i + 1)) / num_bands;
+    }
+    return split;
+}
+
+#endif //ROW_BAND_H
@@ -0,0 +1,133 @@
+#ifndef SAMPLE_MODEL_H
+#define SAMPLE_MODEL_H
+
+#include <cstddef>
+#include <opencv2/core/core.hpp>
+
+/**
+ * Sample storage for the ViBe style background subtractors.
+ *
+ * INTERLEAVED keeps the history samples of a pixel next to each other
+ * (rows x cols x history). PLANAR keeps one rows x cols plane per sample,
+ * every plane row starts on a 64 byte boundary so whole rows can be streamed
+ * through SIMD registers. PACKED is PLANAR with two 4-bit samples per byte,
+ * it can only hold values below 16. Every 16 bytes of a packed row hold 32
+ * pixels, pixel c of the block in the low nibble of byte c and pixel c + 16
+ * in the high nibble, so a block unpacks with a mask and a shift.
+ *
+ * All layouts have a one pixel border around the image, at() accepts rows
+ * -1 to rows and cols -1 to cols so neighbour updates need no bounds checks.
+ * Samples in the border are never read.
+ */
+class SampleModel {
+public:
+    enum Layout {
+        INTERLEAVED = 0,
+        PLANAR = 1,
+        PACKED = 2
+    };
+
+    // Pixels per 16 byte block of a PACKED row
+    static const int PACKED_BLOCK = 32;
+
+    SampleModel(const int rows = 0, const int cols = 0, const int history = 0, const int layout = INTERLEAVED);
+
+    int getRows() const;
+    int getCols() const;
+    int getHistory() const;
+    int getLayout() const;
+    cv::Size size() const;
+    bool empty() const;
+
+    inline unsigned char get(const int r, const int c, const int z) const {
+        if (this->layout == PACKED) {
+            const unsigned char packed = this->origin[r * this->row_step + packedOffset(c) + z * this->sample_step];
+            return (c & 16) ? packed >> 4 : packed & 0x0F;
+        }
+        return this->origin[r * this->row_step + c * this->pixel_step + z * this->sample_step];
+    }
+
+    inline void set(const int r, const int c, const int z, const unsigned char val) {
+        if (this->layout == PACKED) {
+            unsigned char &packed = this->origin[r * this->row_step + packedOffset(c) + z * this->sample_step];
+            if (c & 16) {
+                packed = (packed & 0x0F) | (val << 4);
+            } else {
+                packed = (packed & 0xF0) | (val & 0x0F);
+            }
+            return;
+        }
+        this->origin[r * this->row_step + c * this->pixel_step + z * this->sample_step] = val;
+    }
+
+    /**
+     * Byte holding column c in a PACKED row, the sample is in the high
+     * nibble when bit 4 of c is set.
+     */
+    static inline ptrdiff_t packedOffset(const int c) {
+        return (c >> 5) * 16 + (c & 15);
+    }
+
+    /**
+     * Samples of pixel (r, c), they are only contiguous in the INTERLEAVED
+     * layout. Not used with PACKED.
+     */
+    inline unsigned char* pixel(const int r, const int c) const {
+        return this->origin + r * this->row_step + c * this->pixel_step;
+    }
+
+    /**
+     * Row r of the first sample plane, the row of sample z is found
+     * z * getSampleStep() bytes further. Column c of a PACKED row starts at
+     * byte c / 2 when c is a multiple of 32.
+     */
+    inline unsigned char* row(const int r) const {
+        return this->origin + r * this->row_step;
+    }
+
+    inline size_t getSampleStep() const {
+        return this->sample_step;
+    }
+
+    /**
+     * Copy the samples into a rows x cols x history CV_8U matrix, this is the
+     * layout used in checkpoints.
+     */
+    void toMat(cv::Mat &output) const;
+
+    /**
+     * Load a rows x cols x history CV_8U matrix into the given layout, false
+     * and nothing changed when the matrix is not one.
+     */
+    bool fromMat(const cv::Mat &input, const int layout = INTERLEAVED);
+
+    /**
+     * The samples as stored, border and padding included. Binary checkpoints
+     * keep this block as is, it only fits a model with the same size,
+     * history and layout.
+     */
+    unsigned char* data() const;
+    size_t dataSize() const;
+
+private:
+    static const int ALIGNMENT = 64;
+    // Bytes in front of every planar row, keeps the first pixel aligned.
+    static const int PLANAR_BORDER = ALIGNMENT;
+
+    int rows;
+    int cols;
+    int history;
+    int layout;
+
+    ptrdiff_t row_step;
+    ptrdiff_t pixel_step;
+    ptrdiff_t sample_step;
+
+    cv::Mat storage;
+    // Sample 0 of pixel (0, 0)
+    unsigned char *origin;
+
+    void allocate();
+};
+
+#endif //SAMPLE_MODEL_H
@@ -0,0 +1,57 @@
+#ifndef SCALESUB_H
+#define SCALESUB_H
+
+#include "bsub.hpp"
+
+/**
+ * Runs another background subtractor at a reduced resolution.
+ *
+ * Frames are shrunk by an integer factor with an area filter before they
+ * reach the wrapped subtractor, which has to be created for the reduced
+ * size (see scaledSize). Masks are scaled back up to the input size and
+ * statistics are reported in input pixels.
+ */
+class ScaleSub : public BSub {
+public:
+    ScaleSub(const cv::Ptr<BSub> &subtractor, const int scale = 2);
+    ~ScaleSub();
+    void operator()(cv::InputArray image, cv::OutputArray fgmask, double learning_rate);
+    void apply(cv::InputArray image, cv::OutputArray fgmask, double learning_rate = 0);
+    void applyStats(cv::InputArray image, ForegroundStats &stats, double learning_rate = 0);
+    void maintain(cv::InputArray image, double learning_rate = 0);
+    void getBackgroundImage(cv::OutputArray background_image) const;
+    void setExclusionMask(const cv::Mat &mask);
+    std::ostream& print(std::ostream &out) const;
+    void read(const cv::FileNode &node);
+    void write(cv::FileStorage &fs) const;
+    bool readBinary(CheckpointReader &reader);
+    void writeBinary(CheckpointWriter &writer) const;
+
+    int getScale() const;
+
+    /**
+     * Size of the frames the wrapped subtractor sees for a given input size.
+     */
+    static cv::Size scaledSize(const cv::Size &size, const int scale);
+
+private:
+    cv::Ptr<BSub> subtractor;
+    int scale;
+
+    cv::Size input_size;
+    cv::Mat small_image;
+    cv::Mat small_mask;
+
+    void shrink(cv::InputArray image);
+};
+
+static void write(cv::FileStorage &fs, const std::string&, const ScaleSub &x) {
+    x.write(fs);
+}
+
+static std::ostream& operator<<(std::ostream &out, const ScaleSub &x) {
+    x.print(out);
+    return out;
+}
+
+#endif //SCALESUB_H
@@ -0,0 +1,74 @@
+#ifndef SUBTRACTOR_SET_H
+#define SUBTRACTOR_SET_H
+
+#include <vector>
+#include "bsub.hpp"
+#include "thread_pool.hpp"
+
+/**
+ * Background subtractors run side by side on the same frames.
+ *
+ * The foreground masks and counts are allocated with the first frame and
+ * reused afterwards. Without masks the counts come from the statistics the
+ * subtractors gather while classifying, and once they have warmed up a
+ * frame allocates nothing, with or without threads. With masks that does
+ * not hold: the smoothing and convex hulls of the VANSub and HOFSub masks
+ * allocate scratch memory inside of OpenCV on every frame.
+ *
+ * The subtractors share no mutable state, with more than one thread
+ * applyAll() runs them concurrently and returns once all of them are done.
+ */
+class SubtractorSet {
+public:
+    SubtractorSet(const std::vector<cv::Ptr<BSub> > &subtractors = std::vector<cv::Ptr<BSub> >(), const bool keep_masks = true, const int threads = 1);
+
+    /**
+     * Classify a frame with subtractor i, count(i) holds the number of
+     * foreground pixels afterwards.
+     */
+    void apply(const size_t i, const cv::Mat &image, const double learning_rate);
+    /**
+     * Let subtractor i absorb a frame without classifying it, its mask and
+     * count are cleared.
+     */
+    void maintain(const size_t i, const cv::Mat &image, const double learning_rate);
+
+    /**
+     * Apply subtractors first to size() - 1 to a frame. Every subtractor only
+     * touches its own model, mask and count, so the results do not depend on
+     * the number of threads.
+     */
+    void applyAll(const cv::Mat &image, const double learning_rate, const size_t first = 0);
+    /**
+     * Maintain subtractors first to size() - 1, see maintain().
+     */
+    void maintainAll(const cv::Mat &image, const double learning_rate, const size_t first = 0);
+
+    void setThreads(const int threads);
+
+    size_t size() const;
+    bool keepsMasks() const;
+    const cv::Ptr<BSub>& subtractor(const size_t i) const;
+    const cv::Mat& mask(const size_t i) const;
+    int count(const size_t i) const;
+
+private:
+    std::vector<cv::Ptr<BSub> > subtractors;
+    bool keep_masks;
+    std::vector<cv::Mat> masks;
+    std::vector<int> counts;
+
+    int threads;
+    cv::Ptr<ThreadPool> pool;
+
+    // Frame of the running applyAll() or maintainAll()
+    const cv::Mat *frame;
+    double frame_rate;
+    size_t first;
+    bool maintaining;
+
+    void runAll(const cv::Mat &image, const double learning_rate, const size_t first, const bool maintaining);
+    void runTask(const size_t i);
+};
+
+#endif //SUBTRACTOR_SET_H
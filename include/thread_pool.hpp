@@ -0,0 +1,40 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/**
+ * Small persistent pool of worker threads.
+ *
+ * run() hands out the task indices to the workers and blocks until all of
+ * them are finished, so it acts as a parallel for with a barrier at the end.
+ * Only one thread may call run() at a time.
+ */
+class ThreadPool {
+public:
+    ThreadPool(const int threads);
+    ~ThreadPool();
+
+    int size() const;
+    void run(const int tasks, const std::function<void(int)> &task);
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+
+    const std::function<void(int)> *task;
+    int next_task;
+    int num_tasks;
+    int finished;
+    bool stopping;
+
+    void work();
+};
+
+#endif //THREAD_POOL_H
@@ -2,10 +2,12 @@
 #define VANSUB_H
 
 #include <vector>
-#include <random>
 #include "bsub.hpp"
-
-#include "boost/random.hpp"
+#include "sample_model.hpp"
+#include "counter_rng.hpp"
+#include "random_table.hpp"
+#include "row_band.hpp"
+#include "thread_pool.hpp"
 
 /**
  * van_2014_vibe background subtraction class.
@@ -17,19 +19,33 @@ public:
         const int cols = 0,
         const int radius = 20,
         const int colors = 256,
-        const int history = 20);
+        const int history = 20,
+        const int layout = SampleModel::INTERLEAVED,
+        const int threads = 1);
     VANSub(const VANSub &other);
     ~VANSub();
     void operator()(cv::InputArray image, cv::OutputArray fgmask, double learning_rate);
     void apply(cv::InputArray image, cv::OutputArray fgmask, double learning_rate = 0);
+    void applyStats(cv::InputArray image, ForegroundStats &stats, double learning_rate = 0);
+    void maintain(cv::InputArray image, double learning_rate = 0);
     void getBackgroundImage(cv::OutputArray background_image) const;
     std::ostream& print(std::ostream &out) const;
     void read(const cv::FileNode &node);
     void write(cv::FileStorage &fs) const;
+    bool readBinary(CheckpointReader &reader);
+    void writeBinary(CheckpointWriter &writer) const;
+
+    /**
+     * Number of horizontal bands processed in parallel. The output is
+     * reproducible for a given seed and number of threads.
+     */
+    void setThreads(const int threads);
 
 private:
     static const int req_matches = 2;
     static const int max_colors = 256;
+    // Update probability of 1/16 as a threshold on 32 random bits
+    static const uint32_t update_threshold = 1u << 28;
 
     int rows;
     int cols;
@@ -41,19 +57,41 @@ private:
     float color_expansion;
     bool initiated;
 
-    cv::Ptr<cv::Mat> model;
+    cv::Ptr<SampleModel> model;
     cv::Ptr<cv::Mat> diff;
     cv::Ptr<cv::Mat> background_image;
 
-    double seed;
-    double num_generated;
-    std::mt19937 *gen;
-    boost::random::uniform_real_distribution<float> *update;
-    boost::random::uniform_int_distribution<int> *history_update;
-    boost::random::uniform_int_distribution<int> *pick_neighbor;
+    int seed;
+    int frame;
+    CounterRNG rng;
+    RandomTable table;
+
+    int threads;
+    std::vector<RowBand> bands;
+    // Mask of the last apply and the buffers of its post-processing, reused
+    // between frames
+    cv::Mat mask_buffer;
+    cv::Mat smoothed_mask;
+    std::vector<std::vector<cv::Point> > contours;
+    std::vector<cv::Vec4i> hierarchy;
+    std::vector<std::vector<cv::Point> > hulls;
+    cv::Ptr<ThreadPool> pool;
+
+    // Arguments of the running classify() for the band tasks
+    const cv::Mat *band_image;
+    cv::Mat *band_mask;
+    bool band_all_background;
+    unsigned char reduced[max_colors];
 
     void initiateModel(cv::Mat &image, cv::Rect &random_init);
-    void updateModel(const int &r, const int &c, const unsigned char &val, const bool &update_neighbor = true);
+    /**
+     * With all_background set no pixel is classified, all active pixels
+     * update the model like background pixels.
+     */
+    void classify(cv::InputArray image, cv::Mat *mask, const bool all_background = false);
+    void applyBand(const cv::Mat &input_image, cv::Mat *mask, const unsigned char *reduced, const bool all_background, RowBand &band);
+    void updateModel(const int &r, const int &c, const unsigned char &val, const int &i, RowBand &band);
+    bool updateSample(const int &r, const int &c, const unsigned char &val, const uint32_t &update, const int &slot);
 };
 
 static void write(cv::FileStorage &fs, const std::string&, const VANSub &x) {
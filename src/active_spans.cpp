@@ -0,0 +1,91 @@
+#include "active_spans.hpp"
+
+#include <glog/logging.h>
+
+ActiveSpans::ActiveSpans(const int rows, const int cols) {
+    this->rows = rows;
+    this->cols = cols;
+    this->row_index.push_back(0);
+    this->active_before.push_back(0);
+    for (int r = 0; r < this->rows; r++) {
+        Span span;
+        span.start = 0;
+        span.end = this->cols;
+        if (this->cols > 0) {
+            this->spans.push_back(span);
+        }
+        this->row_index.push_back(this->spans.size());
+        this->active_before.push_back(this->active_before.back() + this->cols);
+    }
+}
+
+ActiveSpans::ActiveSpans(const cv::Mat &mask) {
+    LOG_IF(ERROR, mask.type() != CV_8U) << "Exclusion mask has to be CV_8U.";
+    this->rows = mask.rows;
+    this->cols = mask.cols;
+    this->row_index.push_back(0);
+    this->active_before.push_back(0);
+    for (int r = 0; r < this->rows; r++) {
+        addRow(mask.ptr<unsigned char>(r));
+    }
+}
+
+void ActiveSpans::addRow(const unsigned char *mask_row) {
+    int active = 0;
+    int c = 0;
+    while (c < this->cols) {
+        while (c < this->cols && mask_row[c] == 0) {
+            c++;
+        }
+        if (c == this->cols) {
+            break;
+        }
+        Span span;
+        span.start = c;
+        while (c < this->cols && mask_row[c] != 0) {
+            c++;
+        }
+        span.end = c;
+        active += span.end - span.start;
+        this->spans.push_back(span);
+    }
+    this->row_index.push_back(this->spans.size());
+    this->active_before.push_back(this->active_before.back() + active);
+}
+
+cv::Size ActiveSpans::size() const {
+    return cv::Size(this->cols, this->rows);
+}
+
+bool ActiveSpans::empty() const {
+    return this->rows <= 0 || this->cols <= 0;
+}
+
+bool ActiveSpans::full() const {
+    return count() == this->rows * this->cols;
+}
+
+int ActiveSpans::count(const int row_start, const int row_end) const {
+    return this->active_before[row_end] - this->active_before[row_start];
+}
+
+int ActiveSpans::count() const {
+    return this->active_before.back();
+}
+
+void ActiveSpans::clearExcluded(cv::Mat &image) const {
+    LOG_IF(ERROR, image.rows != this->rows || image.cols != this->cols) << "Different size image: " << image.size() << " vs " << size();
+    for (int r = 0; r < this->rows; r++) {
+        unsigned char *image_row = image.ptr<unsigned char>(r);
+        int c = 0;
+        for (const Span *span = rowBegin(r); span != rowEnd(r); span++) {
+            for (; c < span->start; c++) {
+                image_row[c] = 0;
+            }
+            c = span->end;
+        }
+        for (; c < this->cols; c++) {
+            image_row[c] = 0;
+        }
+    }
+}
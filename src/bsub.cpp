@@ -2,8 +2,11 @@
 
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include "bsub_kernels.hpp"
+
 BSub::BSub(const unsigned int &history) {
     this->model = new cv::Mat();
     VLOG(3) << "Created!";
@@ -11,6 +14,7 @@ BSub::BSub(const unsigned int &history) {
 
 BSub::BSub(const BSub &other) {
     this->model = other.model;
+    this->active = other.active;
     VLOG(3) << "Created!";
 }
 
@@ -23,27 +27,78 @@ void BSub::operator()(cv::InputArray image, cv::OutputArray fgmask, double learn
 }
 
 void BSub::apply(cv::InputArray image, cv::OutputArray fgmask, double learning_rate) {
+    cv::Mat input_image = prepareFrame(image);
+
+    if (fgmask.needed()) {
+        fgmask.create(input_image.size(), CV_8U);
+        cv::Mat mask = fgmask.getMat();
+        if (!this->active.full()) {
+            mask = cv::Scalar(0);
+        }
+        blendFrame(input_image, &mask, NULL, learning_rate);
+    } else {
+        blendFrame(input_image, NULL, NULL, learning_rate);
+    }
+}
+
+void BSub::applyStats(cv::InputArray image, ForegroundStats &stats, double learning_rate) {
+    cv::Mat input_image = prepareFrame(image);
+    blendFrame(input_image, NULL, &stats, learning_rate);
+}
+
+void BSub::maintain(cv::InputArray image, double learning_rate) {
+    ForegroundStats stats;
+    applyStats(image, stats, learning_rate);
+}
+
+cv::Mat BSub::prepareFrame(cv::InputArray image) {
     cv::Mat input_image = image.getMat();
     if (input_image.channels() == 3) {
-        cv::cvtColor(input_image, input_image, CV_BGR2GRAY);
+        cv::cvtColor(input_image, this->gray, CV_BGR2GRAY);
+        input_image = this->gray;
     }
 
     if (this->model->empty()) {
         LOG(INFO) << "Background Model is empty, setting it to a copy of the foreground.";
         input_image.copyTo(*(this->model));
+    } else if (this->model->size() != input_image.size()) {
+        LOG(ERROR) << "Background model size " << this->model->size() << " does not match the frame size " << input_image.size() << ", setting it to a copy of the foreground.";
+        input_image.copyTo(*(this->model));
     }
 
-    cv::Mat diff;
-    cv::absdiff(input_image, *(this->model), diff);
+    updateActiveSpans(input_image.size());
+    return input_image;
+}
 
-    if (fgmask.needed()) {
-        fgmask.create(input_image.size(), input_image.type());
-        cv::Mat mask = fgmask.getMat();
-        cv::threshold(diff, fgmask, 150, 255, cv::THRESH_BINARY);
-    }
+void BSub::blendFrame(const cv::Mat &input_image, cv::Mat *mask, ForegroundStats *stats, const double &rate) {
+    LOG_IF(ERROR, rate < 0 || rate > 1) << "Invalid rate.";
+    const int weight = std::min(std::max(static_cast<int>(rate * BLEND_ONE + 0.5), 0), BLEND_ONE);
 
-    // Update Model
-    updateModel(diff, learning_rate);
+    if (stats != NULL) {
+        stats->reset(this->active.count());
+        this->row_mask.resize(input_image.cols);
+    }
+    for (int r = 0; r < input_image.rows; r++) {
+        const unsigned char *input_row = input_image.ptr<unsigned char>(r);
+        unsigned char *model_row = this->model->ptr<unsigned char>(r);
+        unsigned char *mask_row = NULL;
+        if (mask != NULL) {
+            mask_row = mask->ptr<unsigned char>(r);
+        } else if (stats != NULL) {
+            mask_row = this->row_mask.data();
+        }
+        for (const Span *span = this->active.rowBegin(r); span != this->active.rowEnd(r); span++) {
+            const int c = span->start;
+            blendDifferenceRow(input_row + c, model_row + c, span->end - c, FOREGROUND_THRESHOLD, weight, mask_row == NULL ? NULL : mask_row + c);
+            if (stats != NULL) {
+                for (int i = span->start; i < span->end; i++) {
+                    if (mask_row[i]) {
+                        stats->add(r, i);
+                    }
+                }
+            }
+        }
+    }
 }
 
 void BSub::getBackgroundImage(cv::OutputArray background_image) const {
@@ -58,17 +113,16 @@ void BSub::getBackgroundImage(cv::OutputArray background_image) const {
     VLOG(2) << "Got background image";
 }
 
-void BSub::updateModel(const cv::Mat &diff, const double &rate) {
-    LOG_IF(ERROR, rate < 0 || rate > 1) << "Invalid rate.";
-    LOG_IF(ERROR, this->model->empty() == true) << "Apptempting to update an empty model.";
-    cv::Mat prev_model(*(this->model));
-    for (int r = 0; r < this->model->rows; r++) {
-        for (int c = 0; c < this->model->cols; c++) {
-            unsigned char prev_val = prev_model.at<unsigned char>(r, c);
-            unsigned char distance = diff.at<unsigned char>(r, c);
-            this->model->at<unsigned char>(r, c) = ((1-rate) * prev_val) + (rate * distance);
-        }
+void BSub::setExclusionMask(const cv::Mat &mask) {
+    this->active = ActiveSpans(mask);
+}
+
+void BSub::updateActiveSpans(const cv::Size &size) {
+    if (this->active.size() == size) {
+        return;
     }
+    LOG_IF(ERROR, !this->active.empty()) << "Exclusion mask size " << this->active.size() << " does not match the frame size " << size << ", using every pixel.";
+    this->active = ActiveSpans(size.height, size.width);
 }
 
 void BSub::read(const cv::FileNode &node) {
@@ -84,6 +138,19 @@ void BSub::write(cv::FileStorage &fs) const {
     fs << "}";
 }
 
+bool BSub::readBinary(CheckpointReader &reader) {
+    cv::Mat temp;
+    if (!reader.read("MODEL", temp)) {
+        return false;
+    }
+    this->model = new cv::Mat(temp);
+    return true;
+}
+
+void BSub::writeBinary(CheckpointWriter &writer) const {
+    writer.write("MODEL", *(this->model));
+}
+
 std::ostream& BSub::print(std::ostream &out) const {
     out << "{ ";
     out << "model = " << this->model->size();
@@ -0,0 +1,129 @@
+//C++
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//Logging
+#include <glog/logging.h>
+
+//OpenCV
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+//My Libs
+#include "bsub.hpp"
+#include "vansub.hpp"
+#include "hofsub.hpp"
+#include "mansub.hpp"
+#include "scalesub.hpp"
+
+/** Staic Vars **/
+// Distinct synthetic frames, the benchmark cycles through them
+static const int NUM_FRAMES = 16;
+static const double LEARNING_RATE = 0.1;
+
+std::string getUsage() {
+    std::stringstream ss;
+    ss << "Usage: <frames per run>";
+    return ss.str();
+}
+
+std::string getDesc() {
+    std::stringstream ss;
+    ss << "Description: Measures the throughput of the background subtractors on synthetic frames.";
+    return ss.str();
+}
+
+/**
+ * Noisy gray frames with a bright square moving across them.
+ */
+std::vector<cv::Mat> makeFrames(const cv::Size &size) {
+    std::vector<cv::Mat> frames;
+    cv::RNG rng(47);
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        cv::Mat frame(size, CV_8U);
+        rng.fill(frame, cv::RNG::UNIFORM, cv::Scalar(90), cv::Scalar(110));
+        const int side = size.height / 8;
+        const int x = (i * (size.width - side)) / NUM_FRAMES;
+        cv::rectangle(frame, cv::Rect(x, size.height / 2, side, side), cv::Scalar(220), CV_FILLED);
+        frames.push_back(frame);
+    }
+    return frames;
+}
+
+cv::Ptr<BSub> createSubtractor(const std::string &name, const cv::Size &size) {
+    if (name == "VIBE") {
+        return new VANSub(size.height, size.width);
+    } else if (name == "PBAS") {
+        return new HOFSub(size.height, size.width);
+    } else if (name == "SIGMA") {
+        return new MANSub(size.height, size.width);
+    }
+    return new BSub();
+}
+
+/**
+ * Frames per second of the statistics path over the given number of frames.
+ */
+double measure(cv::Ptr<BSub> subtractor, const std::vector<cv::Mat> &frames, const int num_frames) {
+    ForegroundStats stats;
+    // The first frame initiates the model and is not timed.
+    subtractor->applyStats(frames[0], stats, LEARNING_RATE);
+
+    const int64 start = cv::getTickCount();
+    for (int i = 0; i < num_frames; i++) {
+        subtractor->applyStats(frames[(i + 1) % frames.size()], stats, LEARNING_RATE);
+    }
+    const double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+    return num_frames / seconds;
+}
+
+int main(int argc, char** argv) {
+    // Log to stderr instead of to the tmp directory
+    FLAGS_logtostderr = 1;
+    // Initiate Google Logging
+    google::InitGoogleLogging(argv[0]);
+
+    int num_frames = 100;
+    if (argc > 1) {
+        num_frames = atoi(argv[1]);
+    }
+    if (num_frames <= 0) {
+        LOG(ERROR) << "Number of frames has to be positive.";
+        LOG(ERROR) << getUsage();
+        LOG(ERROR) << getDesc();
+        exit(1);
+    }
+
+    const std::string names[] = {"BSUB", "VIBE", "PBAS", "SIGMA"};
+    const int scales[] = {1, 2, 4};
+    const cv::Size sizes[] = {cv::Size(352, 240), cv::Size(704, 480)};
+
+    std::cout << "SUBTRACTOR\tWIDTH\tHEIGHT\tSCALE\tFPS\tSPEEDUP" << std::endl;
+    for (int i = 0; i < 2; i++) {
+        const cv::Size &size = sizes[i];
+        const std::vector<cv::Mat> frames = makeFrames(size);
+        for (int n = 0; n < 4; n++) {
+            double base_fps = 0;
+            for (int s = 0; s < 3; s++) {
+                cv::Ptr<BSub> subtractor;
+                if (scales[s] == 1) {
+                    subtractor = createSubtractor(names[n], size);
+                } else {
+                    subtractor = new ScaleSub(createSubtractor(names[n], ScaleSub::scaledSize(size, scales[s])), scales[s]);
+                }
+                const double fps = measure(subtractor, frames, num_frames);
+                if (scales[s] == 1) {
+                    base_fps = fps;
+                }
+                std::cout << names[n] << "\t" << size.width << "\t" << size.height << "\t" << scales[s] << "\t";
+                std::cout << std::fixed << std::setprecision(2) << fps << "\t" << fps / base_fps << std::endl;
+            }
+        }
+    }
+
+    return 0;
+}
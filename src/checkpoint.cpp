@@ -0,0 +1,626 @@
+#include "checkpoint.hpp"
+
+#include <glog/logging.h>
+
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <fstream>
+#include <fcntl.h>
+#include <io.h>
+#include <iterator>
+#include <sys/stat.h>
+// No GDI, its ERROR macro collides with LOG(ERROR)
+#ifndef NOGDI
+#define NOGDI
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+static_assert(sizeof(CheckpointHeader) == 64, "Checkpoint header layout changed");
+static_assert(sizeof(CheckpointBlock) == 128, "Checkpoint block layout changed");
+
+CheckpointWriter::CheckpointWriter(const std::string &filename, const bool compress) {
+    this->filename = filename;
+    this->compress = compress;
+    this->failed = false;
+    this->closed = false;
+    this->has_log = false;
+    this->log_offset = 0;
+#ifndef USE_ZLIB
+    LOG_IF(WARNING, compress) << "Built without zlib, checkpoint blocks are stored uncompressed.";
+    this->compress = false;
+#endif
+}
+
+CheckpointWriter::~CheckpointWriter() {
+    if (!this->closed && !this->filename.empty()) {
+        close();
+    }
+}
+
+bool CheckpointWriter::isOpened() const {
+    return !this->failed;
+}
+
+void CheckpointWriter::clear() {
+    // Keeps the capacity, the next snapshot is copied without allocating
+    this->failed = false;
+    this->closed = false;
+    this->prefix.clear();
+    this->group_lengths.clear();
+    this->blocks.clear();
+    this->data.clear();
+    this->has_log = false;
+    this->log_offset = 0;
+    this->log_data.clear();
+}
+
+void CheckpointWriter::beginGroup(const std::string &name) {
+    this->group_lengths.push_back(this->prefix.size());
+    this->prefix += name + "/";
+}
+
+void CheckpointWriter::endGroup() {
+    LOG_IF(ERROR, this->group_lengths.empty()) << "No checkpoint group to end.";
+    if (!this->group_lengths.empty()) {
+        this->prefix.resize(this->group_lengths.back());
+        this->group_lengths.pop_back();
+    }
+}
+
+void CheckpointWriter::write(const std::string &name, const cv::Mat &mat) {
+    if (mat.dims > 2) {
+        LOG(ERROR) << "Checkpoint block " << this->prefix + name << " has more than two dimensions.";
+        this->failed = true;
+        return;
+    }
+    const cv::Mat continuous = mat.isContinuous() ? mat : mat.clone();
+    addBlock(name, mat.type(), mat.rows, mat.cols, continuous.data, mat.total() * mat.elemSize());
+}
+
+void CheckpointWriter::write(const std::string &name, const int value) {
+    const int32_t stored = value;
+    addBlock(name, CV_32S, 1, 1, &stored, sizeof(stored));
+}
+
+void CheckpointWriter::write(const std::string &name, const double value) {
+    addBlock(name, CV_64F, 1, 1, &value, sizeof(value));
+}
+
+void CheckpointWriter::write(const std::string &name, const void *data, const size_t size) {
+    addBlock(name, CV_8U, 1, size, data, size);
+}
+
+void CheckpointWriter::log(const uint64_t offset, const void *data, const size_t size) {
+    this->has_log = true;
+    this->log_offset = offset;
+    this->log_data.assign(static_cast<const unsigned char*>(data), static_cast<const unsigned char*>(data) + size);
+}
+
+void CheckpointWriter::addBlock(const std::string &name, const int type, const int rows, const int cols, const void *data, const size_t size) {
+    if (!isOpened()) {
+        return;
+    }
+    const std::string full_name = this->prefix + name;
+    CheckpointBlock block;
+    memset(&block, 0, sizeof(block));
+    if (full_name.size() >= sizeof(block.name)) {
+        LOG(ERROR) << "Checkpoint block name " << full_name << " is too long.";
+        this->failed = true;
+        return;
+    }
+    strncpy(block.name, full_name.c_str(), sizeof(block.name) - 1);
+    block.type = type;
+    block.rows = rows;
+    block.cols = cols;
+    block.size = size;
+
+    // Offset into the snapshot until save() places the block in the file
+    block.offset = cv::alignSize(this->data.size(), ALIGNMENT);
+    block.stored_size = size;
+    this->data.resize(block.offset + size);
+    if (size > 0) {
+        memcpy(&this->data[block.offset], data, size);
+    }
+    this->blocks.push_back(block);
+}
+
+bool CheckpointWriter::saveLog(const std::string &filename) {
+    // Cutting the log first drops what a failed save may have left behind
+#ifdef _WIN32
+    const int fd = _open(filename.c_str(), _O_WRONLY | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+    bool written = fd >= 0 && _chsize_s(fd, this->log_offset) == 0
+        && _lseeki64(fd, this->log_offset, SEEK_SET) == static_cast<__int64>(this->log_offset);
+#else
+    const int fd = open(filename.c_str(), O_WRONLY | O_CREAT, 0644);
+    bool written = fd >= 0 && ftruncate(fd, this->log_offset) == 0
+        && lseek(fd, this->log_offset, SEEK_SET) == static_cast<off_t>(this->log_offset);
+#endif
+    size_t position = 0;
+    while (written && position < this->log_data.size()) {
+#ifdef _WIN32
+        const int count = _write(fd, &this->log_data[position], this->log_data.size() - position);
+#else
+        const ssize_t count = ::write(fd, &this->log_data[position], this->log_data.size() - position);
+#endif
+        written = count > 0;
+        position += written ? count : 0;
+    }
+    written = written && syncFile(fd);
+    if (fd >= 0) {
+#ifdef _WIN32
+        written = (_close(fd) == 0) && written;
+#else
+        written = (::close(fd) == 0) && written;
+#endif
+    }
+    LOG_IF(ERROR, !written) << "Could not write checkpoint log " << filename;
+    return written;
+}
+
+bool CheckpointWriter::pad(FILE *file, size_t &position) {
+    static const char zeros[ALIGNMENT] = {0};
+    const size_t padding = cv::alignSize(position, ALIGNMENT) - position;
+    position += padding;
+    return fwrite(zeros, 1, padding, file) == padding;
+}
+
+bool CheckpointWriter::writeAligned(FILE *file, const void *data, const size_t size, size_t &position) {
+    if (!pad(file, position) || fwrite(data, 1, size, file) != size) {
+        return false;
+    }
+    position += size;
+    return true;
+}
+
+bool CheckpointWriter::save(const std::string &filename) {
+    if (this->failed) {
+        LOG(ERROR) << "Could not write checkpoint " << filename;
+        return false;
+    }
+    // The log has to be complete before a checkpoint refers to it
+    if (this->has_log && !saveLog(filename + ".log")) {
+        return false;
+    }
+
+    const std::string temp_filename = filename + ".tmp";
+    FILE *file = fopen(temp_filename.c_str(), "wb");
+    if (file == NULL) {
+        LOG(ERROR) << "Could not open checkpoint file " << temp_filename;
+        return false;
+    }
+
+    // The header is filled in once the table is written
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    size_t position = 0;
+    bool written = writeAligned(file, &header, sizeof(header), position);
+
+    this->table.assign(this->blocks.begin(), this->blocks.end());
+    for (size_t i = 0; written && i < this->table.size(); i++) {
+        CheckpointBlock &block = this->table[i];
+        const unsigned char *stored = this->data.data() + block.offset;
+#ifdef USE_ZLIB
+        if (this->compress && block.size >= MIN_DEFLATE_SIZE) {
+            uLongf deflated_size = compressBound(block.size);
+            this->deflated.resize(deflated_size);
+            if (compress2(this->deflated.data(), &deflated_size, stored, block.size, Z_BEST_SPEED) == Z_OK && deflated_size < block.size) {
+                stored = this->deflated.data();
+                block.stored_size = deflated_size;
+                block.flags |= CheckpointBlock::DEFLATED;
+            }
+        }
+#endif
+        written = pad(file, position);
+        block.offset = position;
+        written = written && writeAligned(file, stored, block.stored_size, position);
+    }
+
+    if (written) {
+        memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+        header.version = CHECKPOINT_VERSION;
+        header.block_count = this->table.size();
+        header.log_size = this->has_log ? this->log_offset + this->log_data.size() : 0;
+        written = pad(file, position);
+        header.table_offset = position;
+        written = written && writeAligned(file, this->table.data(), this->table.size() * sizeof(CheckpointBlock), position);
+        header.file_size = position;
+        written = written && fseek(file, 0, SEEK_SET) == 0
+            && fwrite(&header, sizeof(header), 1, file) == 1;
+    }
+    // The data has to be on the disk before the rename makes it the
+    // checkpoint.
+    written = written && fflush(file) == 0 && syncFile(fileno(file));
+    written = (fclose(file) == 0) && written;
+
+    if (!written) {
+        LOG(ERROR) << "Could not write checkpoint " << filename;
+        std::remove(temp_filename.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    // rename() does not replace existing files on Windows, MoveFileEx does
+    // so without a moment where there is no checkpoint.
+    const bool moved = MoveFileExA(temp_filename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    const bool moved = std::rename(temp_filename.c_str(), filename.c_str()) == 0;
+#endif
+    if (!moved) {
+        LOG(ERROR) << "Could not move " << temp_filename << " to " << filename;
+        std::remove(temp_filename.c_str());
+        return false;
+    }
+    syncDirectory(filename);
+    return true;
+}
+
+bool CheckpointWriter::close() {
+    if (!this->closed) {
+        this->closed = true;
+        this->failed = !save(this->filename);
+    }
+    return !this->failed;
+}
+
+bool CheckpointWriter::syncFile(const int fd) {
+#ifdef _WIN32
+    return _commit(fd) == 0;
+#else
+    return fsync(fd) == 0;
+#endif
+}
+
+void CheckpointWriter::syncDirectory(const std::string &filename) {
+#ifndef _WIN32
+    // Makes the rename itself durable
+    const size_t separator = filename.find_last_of('/');
+    const std::string directory = separator == std::string::npos ? "." : filename.substr(0, separator + 1);
+    const int fd = open(directory.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        ::close(fd);
+    }
+#endif
+}
+
+CheckpointSaver::CheckpointSaver(const std::string &filename, const bool compress) {
+    this->filename = filename;
+    for (int i = 0; i < 2; i++) {
+        this->writers[i] = CheckpointWriter(std::string(), compress);
+    }
+    this->filling = -1;
+    this->pending = -1;
+    this->saving = -1;
+    this->stopping = false;
+    this->failed = false;
+    this->finished_count = 0;
+    this->reported_count = 0;
+    this->thread = std::thread(&CheckpointSaver::run, this);
+}
+
+CheckpointSaver::~CheckpointSaver() {
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->stopping = true;
+        this->work.notify_one();
+    }
+    this->thread.join();
+}
+
+CheckpointWriter* CheckpointSaver::snapshot() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    for (int i = 0; i < 2; i++) {
+        if (i != this->pending && i != this->saving) {
+            this->filling = i;
+            this->writers[i].clear();
+            return &this->writers[i];
+        }
+    }
+    return NULL;
+}
+
+void CheckpointSaver::save() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    LOG_IF(ERROR, this->filling < 0) << "No checkpoint snapshot to save.";
+    if (this->filling >= 0) {
+        this->pending = this->filling;
+        this->filling = -1;
+        this->work.notify_one();
+    }
+}
+
+bool CheckpointSaver::finished(bool &saved) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (this->reported_count == this->finished_count) {
+        return false;
+    }
+    this->reported_count = this->finished_count;
+    saved = !this->failed;
+    return true;
+}
+
+bool CheckpointSaver::busy() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return this->pending >= 0 || this->saving >= 0;
+}
+
+bool CheckpointSaver::wait() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (this->pending >= 0 || this->saving >= 0) {
+        this->done.wait(lock);
+    }
+    return !this->failed;
+}
+
+void CheckpointSaver::run() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        while (!this->stopping && this->pending < 0) {
+            this->work.wait(lock);
+        }
+        if (this->pending < 0) {
+            break;
+        }
+        this->saving = this->pending;
+        this->pending = -1;
+
+        // The frame loop may fill the other writer meanwhile
+        lock.unlock();
+        const bool saved = this->writers[this->saving].save(this->filename);
+        lock.lock();
+
+        this->saving = -1;
+        this->failed = !saved;
+        this->finished_count++;
+        this->done.notify_all();
+    }
+}
+
+CheckpointReader::CheckpointReader(const std::string &filename) {
+    this->log_filename = filename + ".log";
+    this->mapping = NULL;
+    this->mapping_size = 0;
+    this->header = NULL;
+    this->blocks = NULL;
+
+#ifdef _WIN32
+    std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        LOG(WARNING) << "Could not open checkpoint file " << filename;
+        return;
+    }
+    this->buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    this->mapping = this->buffer.data();
+    this->mapping_size = this->buffer.size();
+#else
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOG(WARNING) << "Could not open checkpoint file " << filename;
+        return;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            this->mapping = static_cast<const unsigned char*>(mapped);
+            this->mapping_size = info.st_size;
+        }
+    }
+    ::close(fd);
+    if (this->mapping == NULL) {
+        LOG(ERROR) << "Could not map checkpoint file " << filename;
+        return;
+    }
+#endif
+
+    if (!validate()) {
+        LOG(ERROR) << "Invalid checkpoint file " << filename;
+        unmap();
+    }
+}
+
+CheckpointReader::~CheckpointReader() {
+    unmap();
+}
+
+void CheckpointReader::unmap() {
+#ifndef _WIN32
+    if (this->mapping != NULL) {
+        munmap(const_cast<unsigned char*>(this->mapping), this->mapping_size);
+    }
+#endif
+    this->buffer.clear();
+    this->mapping = NULL;
+    this->mapping_size = 0;
+    this->header = NULL;
+    this->blocks = NULL;
+}
+
+bool CheckpointReader::validate() {
+    if (this->mapping_size < sizeof(CheckpointHeader)) {
+        return false;
+    }
+    const CheckpointHeader *header = reinterpret_cast<const CheckpointHeader*>(this->mapping);
+    if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0) {
+        return false;
+    }
+    if (header->version != CHECKPOINT_VERSION) {
+        LOG(ERROR) << "Checkpoint version " << header->version << " is not supported, expected " << CHECKPOINT_VERSION;
+        return false;
+    }
+    // A checkpoint that was cut short has a different size
+    if (header->file_size != this->mapping_size || header->table_offset > this->mapping_size) {
+        return false;
+    }
+    if (header->block_count > (this->mapping_size - header->table_offset) / sizeof(CheckpointBlock)) {
+        return false;
+    }
+
+    const CheckpointBlock *blocks = reinterpret_cast<const CheckpointBlock*>(this->mapping + header->table_offset);
+    for (uint32_t i = 0; i < header->block_count; i++) {
+        const CheckpointBlock &block = blocks[i];
+        if (block.name[sizeof(block.name) - 1] != '\0' || block.rows < 0 || block.cols < 0) {
+            return false;
+        }
+        if (block.offset > header->table_offset || block.stored_size > header->table_offset - block.offset) {
+            return false;
+        }
+        if (static_cast<uint64_t>(block.rows) * block.cols * CV_ELEM_SIZE(block.type) != block.size) {
+            return false;
+        }
+        if (!(block.flags & CheckpointBlock::DEFLATED) && block.stored_size != block.size) {
+            return false;
+        }
+    }
+
+    this->header = header;
+    this->blocks = blocks;
+    return true;
+}
+
+bool CheckpointReader::isOpened() const {
+    return this->header != NULL;
+}
+
+void CheckpointReader::beginGroup(const std::string &name) {
+    this->group_lengths.push_back(this->prefix.size());
+    this->prefix += name + "/";
+}
+
+void CheckpointReader::endGroup() {
+    LOG_IF(ERROR, this->group_lengths.empty()) << "No checkpoint group to end.";
+    if (!this->group_lengths.empty()) {
+        this->prefix.resize(this->group_lengths.back());
+        this->group_lengths.pop_back();
+    }
+}
+
+const CheckpointBlock* CheckpointReader::find(const std::string &name) const {
+    if (!isOpened()) {
+        return NULL;
+    }
+    const std::string full_name = this->prefix + name;
+    for (uint32_t i = 0; i < this->header->block_count; i++) {
+        if (full_name == this->blocks[i].name) {
+            return &this->blocks[i];
+        }
+    }
+    VLOG(1) << "Checkpoint block " << full_name << " is missing.";
+    return NULL;
+}
+
+bool CheckpointReader::copyBlock(const CheckpointBlock &block, void *data) const {
+    const unsigned char *stored = this->mapping + block.offset;
+    if (block.flags & CheckpointBlock::DEFLATED) {
+#ifdef USE_ZLIB
+        uLongf size = block.size;
+        if (uncompress(static_cast<Bytef*>(data), &size, stored, block.stored_size) != Z_OK || size != block.size) {
+            LOG(ERROR) << "Could not inflate checkpoint block " << block.name;
+            return false;
+        }
+        return true;
+#else
+        LOG(ERROR) << "Checkpoint block " << block.name << " is deflated, build with USE_ZLIB to read it.";
+        return false;
+#endif
+    }
+    memcpy(data, stored, block.size);
+    return true;
+}
+
+uint64_t CheckpointReader::logSize() const {
+    return isOpened() ? this->header->log_size : 0;
+}
+
+bool CheckpointReader::readLog(void *data, const size_t size) const {
+    if (size > logSize()) {
+        LOG(ERROR) << "Checkpoint log holds " << logSize() << " bytes, " << size << " requested.";
+        return false;
+    }
+    if (size == 0) {
+        return true;
+    }
+    FILE *file = fopen(this->log_filename.c_str(), "rb");
+    if (file == NULL) {
+        LOG(ERROR) << "Could not open checkpoint log " << this->log_filename;
+        return false;
+    }
+    const bool read = fread(data, 1, size, file) == size;
+    fclose(file);
+    LOG_IF(ERROR, !read) << "Checkpoint log " << this->log_filename << " is truncated.";
+    return read;
+}
+
+bool CheckpointReader::has(const std::string &name) const {
+    return find(name) != NULL;
+}
+
+bool CheckpointReader::read(const std::string &name, cv::Mat &mat) const {
+    const CheckpointBlock *block = find(name);
+    if (block == NULL) {
+        return false;
+    }
+    mat.create(block->rows, block->cols, block->type);
+    return copyBlock(*block, mat.data);
+}
+
+bool CheckpointReader::read(const std::string &name, int &value) const {
+    const CheckpointBlock *block = find(name);
+    if (block == NULL || block->type != CV_32S || block->size != sizeof(int32_t)) {
+        return false;
+    }
+    int32_t stored;
+    if (!copyBlock(*block, &stored)) {
+        return false;
+    }
+    value = stored;
+    return true;
+}
+
+bool CheckpointReader::read(const std::string &name, bool &value) const {
+    int stored;
+    if (!read(name, stored)) {
+        return false;
+    }
+    value = stored != 0;
+    return true;
+}
+
+bool CheckpointReader::read(const std::string &name, float &value) const {
+    double stored;
+    if (!read(name, stored)) {
+        return false;
+    }
+    value = stored;
+    return true;
+}
+
+bool CheckpointReader::read(const std::string &name, double &value) const {
+    const CheckpointBlock *block = find(name);
+    if (block == NULL || block->type != CV_64F || block->size != sizeof(double)) {
+        return false;
+    }
+    return copyBlock(*block, &value);
+}
+
+bool CheckpointReader::read(const std::string &name, void *data, const size_t size) const {
+    const CheckpointBlock *block = find(name);
+    if (block == NULL || block->size != size) {
+        return false;
+    }
+    return copyBlock(*block, data);
+}
@@ -1,7 +1,9 @@
 #include "hofsub.hpp"
+#include "bsub_kernels.hpp"
 
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <cmath>
 #include <opencv2/imgproc/imgproc.hpp>
 
@@ -22,9 +24,13 @@ HOFSub::HOFSub(
         const int cols,
         const int threshold,
         const int colors,
-        const int history
+        const int history,
+        const int layout,
+        const int threads,
+        const int precision
         ) {
     LOG_IF(ERROR, history <= 0) << "History was set to zero.";
+    LOG_IF(ERROR, history > static_cast<int>(CounterRNG::MAX_DRAWS)) << "History is larger than the number of random draws per pixel.";
 
     this->initiated = false;
 
@@ -36,18 +42,29 @@ HOFSub::HOFSub(
     this->color_reduction = static_cast<float>(this->colors)/this->MAX_COLORS;
     this->color_expansion = static_cast<float>(this->MAX_COLORS)/this->colors;
 
-    int sizes[] = {this->rows, this->cols, this->history};
-    this->model = new cv::Mat(3, sizes, CV_8U, cv::Scalar(0));
-    this->decision_distance = new cv::Mat(this->rows, this->cols, CV_32F, cv::Scalar(0));
-    this->threshold = new cv::Mat(this->rows, this->cols, CV_32F, cv::Scalar(threshold));
-    this->update_val = new cv::Mat(this->rows, this->cols, CV_32F, cv::Scalar(UPDATE_MIN));
+    // Packed samples only hold 4 bits
+    LOG_IF(ERROR, layout == SampleModel::PACKED && this->colors > 16) << "Packed layout needs 16 colors or less, using planar.";
+    const int model_layout = (layout == SampleModel::PACKED && this->colors > 16) ? SampleModel::PLANAR : layout;
+    this->model = new SampleModel(this->rows, this->cols, this->history, model_layout);
+    this->state = new PixelState(this->rows, this->cols, precision);
+    this->state->fill(PixelState::THRESHOLD, threshold);
+    LOG_IF(WARNING, threshold > this->state->maxValue(PixelState::THRESHOLD)) << "Threshold " << threshold << " saturates at " << this->state->maxValue(PixelState::THRESHOLD) << ".";
+    // Neighbours outside of the image keep UPDATE_MAX, so only one in
+    // UPDATE_MAX of the neighbour updates landing there writes to the model
+    // border. The border samples are never read.
+    this->state->fill(PixelState::UPDATE, UPDATE_MAX);
+    this->state->fromMat(PixelState::UPDATE, cv::Mat(this->rows, this->cols, CV_32F, cv::Scalar(UPDATE_MIN)));
 
     this->seed = 0;
-    this->num_generated = 1;
-    this->gen = new std::mt19937(this->seed);
-    this->update = new boost::random::uniform_real_distribution<float>(0, 1);
-    this->history_update = new boost::random::uniform_int_distribution<int>(0, history-1);
-    this->pick_neighbor = new boost::random::uniform_int_distribution<int>(0, 7);
+    this->frame = 0;
+    this->rng = CounterRNG(this->seed);
+    this->table = RandomTable(this->seed, this->cols, this->history);
+
+    this->band_image = NULL;
+    this->band_mask = NULL;
+    this->band_learning_rate = 0;
+    this->band_all_background = false;
+    setThreads(threads);
 }
 
 HOFSub::HOFSub(const HOFSub &other) {
@@ -62,85 +79,56 @@ HOFSub::HOFSub(const HOFSub &other) {
     this->color_expansion = other.color_expansion;
 
     this->model = other.model;
-    this->decision_distance = other.decision_distance;
-    this->threshold = other.threshold;
-    this->update_val = other.update_val;
+    this->state = other.state;
 
     this->seed = other.seed;
-    this->num_generated = other.num_generated;
-    this->gen = new std::mt19937(seed);
-    this->gen->discard(num_generated);
-
-    this->update = new boost::random::uniform_real_distribution<float>(0, 1);
-    this->history_update = new boost::random::uniform_int_distribution<int>(0, history-1);
-    this->pick_neighbor = new boost::random::uniform_int_distribution<int>(0, 7);
+    this->frame = other.frame;
+    this->rng = other.rng;
+    this->table = other.table;
+
+    this->band_image = NULL;
+    this->band_mask = NULL;
+    this->band_learning_rate = 0;
+    this->band_all_background = false;
+    setThreads(other.threads);
 }
 
 HOFSub::~HOFSub() {
-    delete this->update;
-    delete this->history_update;
-    delete this->pick_neighbor;
 }
 
-void HOFSub::updateModel(const int &r, const int &c, const unsigned char &val, const bool &update_neighbor) {
-    // Add pixel value to background model.
-    this->num_generated += 1;
-    float rng_update = (*(this->update))(*(this->gen));
-    if (rng_update <= 1/this->update_val->at<float>(r,c)) {
-        this->num_generated += 1;
-        int pos = (*(this->history_update))(*(this->gen));
-        LOG_IF(ERROR, pos >= this->history) << "RNG Error";
-        this->model->at<unsigned char>(r,c,pos) = val;
-        if (update_neighbor) {
-            this->num_generated += 1;
-            int neighbor = (*(this->pick_neighbor))(*(this->gen));
-            switch(neighbor) {
-                case 0:
-                    if (r > 1 && c > 1) {
-                        updateModel(r-1, c-1, val, false);
-                    }
-                    break;
-                case 1:
-                    if (r > 1) {
-                        updateModel(r-1, c, val, false);
-                    }
-                    break;
-                case 2:
-                    if (r > 1 && c < this->cols - 1) {
-                        updateModel(r-1, c+1, val, false);
-                    }
-                    break;
-                case 3:
-                    if (c > 1) {
-                        updateModel(r, c-1, val, false);
-                    }
-                    break;
-                case 4:
-                    if (c < this->cols - 1) {
-                        updateModel(r, c+1, val, false);
-                    }
-                    break;
-                case 5:
-                    if (r < this->rows - 1 && c > 1) {
-                        updateModel(r+1, c-1, val, false);
-                    }
-                    break;
-                case 6:
-                    if (r < this->rows - 1) {
-                        updateModel(r+1, c, val, false);
-                    }
-                    break;
-                case 7:
-                    if (r < this->rows - 1 && c < this->cols - 1) {
-                        updateModel(r+1, c+1, val, false);
-                    }
-                    break;
-                default:
-                    LOG(ERROR) << "Unknown case selected for neightbor update.";
-                    break;
-            }
-        }
+void HOFSub::setThreads(const int threads) {
+    LOG_IF(ERROR, threads <= 0) << "Number of threads has to be positive.";
+    this->threads = threads > 0 ? threads : 1;
+    this->bands = splitRows(this->rows, this->threads);
+    if (this->threads > 1) {
+        this->pool = new ThreadPool(this->threads);
+    } else {
+        this->pool.release();
+    }
+}
+
+bool HOFSub::updateSample(const int &r, const int &c, const unsigned char &val, const uint32_t &update, const int &slot) {
+    // The state has a border so neighbours outside of the image can be read.
+    if (update >= this->state->updateThreshold(r, c)) {
+        return false;
     }
+    this->model->set(r, c, slot, val);
+    return true;
+}
+
+void HOFSub::updateModel(const int &r, const int &c, const unsigned char &val, const int &i, RowBand &band) {
+    // Add pixel value to background model, i indexes the random table.
+    if (updateSample(r, c, val, this->table.update(i), this->table.slot(i))) {
+        // The neighbour update is batched with the rest of the row, updates
+        // outside of the image end up in the border of the model.
+        band.add(r + this->table.neighborRow(i), c + this->table.neighborCol(i), val, this->table.neighborUpdate(i), this->table.neighborSlot(i));
+    }
+}
+
+// Structuring element of the mask smoothing, built on first use.
+static const cv::Mat& smoothingKernel() {
+    static const cv::Mat kernel = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(5,5), cv::Point(0,0));
+    return kernel;
 }
 
 //Only supports 8-bit images
@@ -149,6 +137,46 @@ void HOFSub::operator()(cv::InputArray image, cv::OutputArray fgmask, double lea
 }
 
 void HOFSub::apply(cv::InputArray image, cv::OutputArray fgmask, double learning_rate) {
+    // The mask buffer is kept between frames
+    cv::Mat &mask = this->mask_buffer;
+    mask.create(this->rows, this->cols, CV_8U);
+    mask = cv::Scalar(255);
+    classify(image, &mask, learning_rate);
+    if (!this->active.full()) {
+        this->active.clearExcluded(mask);
+    }
+
+    if (fgmask.needed()) {
+        // Smooth mask (remove noise)
+        //cv::Mat kernel = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(4,4), cv::Point(0,0));
+        // The buffers are kept between frames, OpenCV still allocates its
+        // own scratch memory in here.
+        const cv::Mat &kernel = smoothingKernel();
+        cv::morphologyEx(mask, this->smoothed_mask, cv::MORPH_OPEN, kernel);
+        cv::morphologyEx(this->smoothed_mask, mask, cv::MORPH_CLOSE, kernel);
+
+        mask.copyTo(fgmask);
+
+        // Find Convex Hull
+        cv::findContours(mask, this->contours, this->hierarchy, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+        this->hulls.resize(this->contours.size());
+        for (unsigned int i = 0; i < this->contours.size(); i++) {
+            cv::convexHull(cv::Mat(this->contours[i]), this->hulls[i], false);
+            cv::drawContours(fgmask, this->hulls, i, cv::Scalar(100), CV_FILLED);
+        }
+    }
+}
+
+void HOFSub::applyStats(cv::InputArray image, ForegroundStats &stats, double learning_rate) {
+    classify(image, NULL, learning_rate);
+    mergeStats(this->bands, stats);
+}
+
+void HOFSub::maintain(cv::InputArray image, double learning_rate) {
+    classify(image, NULL, learning_rate, true);
+}
+
+void HOFSub::classify(cv::InputArray image, cv::Mat *mask, double learning_rate, const bool all_background) {
     cv::Mat input_image = image.getMat();
     if (input_image.channels() == 3) {
         cv::cvtColor(input_image, input_image, CV_BGR2GRAY);
@@ -161,76 +189,225 @@ void HOFSub::apply(cv::InputArray image, cv::OutputArray fgmask, double learning
         initiateModel(input_image, random_init);
         this->initiated = true;
     }
+    updateActiveSpans(input_image.size());
 
-    cv::Mat mask(this->rows, this->cols, CV_8U, cv::Scalar(255));
-
-    for (int r = 0; r < input_image.rows; r++) {
-        for (int c = 0; c < input_image.cols; c++) {
-            unsigned char input_val = input_image.at<unsigned char>(r,c) * this->color_reduction;
-            int matches = 0;
-            float min_dist = THRESH_MAX;
-            for (int z = 0; z < this->history; z++) {
-                float dist = abs(static_cast<float>(input_val) - this->model->at<unsigned char>(r,c,z));
-                if (dist <= this->threshold->at<float>(r,c)) {
-                    matches++;
-                }
-                if (dist < min_dist) {
-                    min_dist = dist;
-                }
-            }
-            this->decision_distance->at<float>(r,c) = learning_rate * min_dist + (1 - learning_rate) * this->decision_distance->at<float>(r,c);
+    this->table.fill(this->frame);
 
-            // Update threshold
-            if (this->threshold->at<float>(r,c) > this->decision_distance->at<float>(r,c)  * THRESH_SCALE) {
-                this->threshold->at<float>(r,c) = this->threshold->at<float>(r,c) * (1 - THRESH_DEC_RATE);
-                if (this->threshold->at<float>(r,c) < THRESH_MIN) {
-                    this->threshold->at<float>(r,c) = THRESH_MIN;
-                }
+    if (this->bands.size() == 1) {
+        if (all_background) {
+            maintainBand(input_image, this->bands[0]);
+        } else {
+            applyBand(input_image, mask, learning_rate, this->bands[0]);
+        }
+    } else {
+        this->band_image = &input_image;
+        this->band_mask = mask;
+        this->band_learning_rate = learning_rate;
+        this->band_all_background = all_background;
+        // Only capturing this keeps the task small enough for std::function
+        // to store it without allocating.
+        this->pool->run(this->bands.size(), [this](int i) {
+            if (this->band_all_background) {
+                maintainBand(*(this->band_image), this->bands[i]);
             } else {
-                this->threshold->at<float>(r,c) = this->threshold->at<float>(r,c) * (1 + THRESH_INC_RATE);
-                if (this->threshold->at<float>(r,c) > THRESH_MAX) {
-                    this->threshold->at<float>(r,c) = THRESH_MAX;
-                }
+                applyBand(*(this->band_image), this->band_mask, this->band_learning_rate, this->bands[i]);
             }
+        });
+        this->band_image = NULL;
+    }
 
-            // Update model
-            if (matches >= REQ_MATCHES) { // Background
-                // Set foreground mask to zero.
-                mask.at<unsigned char>(r,c) = 0;
-                this->update_val->at<float>(r,c) = this->update_val->at<float>(r,c) - UPDATE_DEC_RATE/this->decision_distance->at<float>(r,c);
-                if (this->update_val->at<float>(r,c) < UPDATE_MIN) {
-                    this->update_val->at<float>(r,c) = UPDATE_MIN;
-                }
-                updateModel(r, c, input_val);
-            } else { // Foreground
-                this->update_val->at<float>(r,c) = this->update_val->at<float>(r,c) + UPDATE_INC_RATE/this->decision_distance->at<float>(r,c);
-                if (this->update_val->at<float>(r,c) > UPDATE_MAX) {
-                    this->update_val->at<float>(r,c) = UPDATE_MAX;
-                }
+    // Neighbour updates that crossed a band boundary, applied in band order
+    // so the result only depends on the seed and the number of threads.
+    for (size_t i = 0; i < this->bands.size(); i++) {
+        std::vector<DeferredUpdate> &deferred = this->bands[i].deferred;
+        for (size_t j = 0; j < deferred.size(); j++) {
+            updateSample(deferred[j].r, deferred[j].c, deferred[j].val, deferred[j].update, deferred[j].slot);
+        }
+        deferred.clear();
+    }
+    this->frame++;
+}
+
+void HOFSub::applyBand(const cv::Mat &input_image, cv::Mat *mask, const double &learning_rate, RowBand &band) {
+    if (this->state->getPrecision() == PixelState::FIXED) {
+        applyRows<uint16_t>(input_image, mask, learning_rate, band);
+    } else {
+        applyRows<float>(input_image, mask, learning_rate, band);
+    }
+}
+
+// Float view of the active spans of a state row, fixed point rows are
+// decoded into buffer and written back by storeRow.
+static inline float* loadRow(float *row, float*, const Span*, const Span*, const int) {
+    return row;
+}
+
+static inline float* loadRow(uint16_t *row, float *buffer, const Span *begin, const Span *end, const int field) {
+    for (const Span *span = begin; span != end; span++) {
+        for (int c = span->start; c < span->end; c++) {
+            buffer[c] = PixelState::decode(row[c], field);
+        }
+    }
+    return buffer;
+}
+
+static inline void storeRow(float*, const float*, const Span*, const Span*, const int) {
+}
+
+static inline void storeRow(uint16_t *row, const float *values, const Span *begin, const Span *end, const int field) {
+    for (const Span *span = begin; span != end; span++) {
+        for (int c = span->start; c < span->end; c++) {
+            PixelState::encode(row[c], values[c], field);
+        }
+    }
+}
+
+// Fixed point states keep the update values only as update thresholds, they
+// are decoded into buffer. adaptStateRow() writes the new thresholds.
+static inline void loadUpdates(const uint32_t *thresholds, float *buffer, const Span *begin, const Span *end) {
+    for (const Span *span = begin; span != end; span++) {
+        for (int c = span->start; c < span->end; c++) {
+            buffer[c] = PixelState::decodeUpdate(thresholds[c]);
+        }
+    }
+}
+
+void HOFSub::maintainBand(const cv::Mat &input_image, RowBand &band) {
+    band.reserve(input_image.cols);
+    band.stats.reset(this->active.count(band.row_start, band.row_end));
+    for (int r = band.row_start; r < band.row_end; r++) {
+        const int row_offset = this->table.rowOffset(r);
+        const unsigned char *input_row = input_image.ptr<unsigned char>(r);
+        for (const Span *span = this->active.rowBegin(r); span != this->active.rowEnd(r); span++) {
+            for (int c = span->start; c < span->end; c++) {
+                unsigned char input_val = input_row[c] * this->color_reduction;
+                updateModel(r, c, input_val, row_offset + c, band);
             }
         }
+        flushRow(band);
     }
+}
 
-    if (fgmask.needed()) {
-        fgmask.create(input_image.size(), input_image.type());
+void HOFSub::flushRow(RowBand &band) {
+    for (size_t j = 0; j < band.batch.size(); j++) {
+        const DeferredUpdate &update = band.batch[j];
+        if (band.contains(update.r)) {
+            updateSample(update.r, update.c, update.val, update.update, update.slot);
+        } else {
+            band.deferred.push_back(update);
+        }
+    }
+    band.batch.clear();
+}
 
-        // Smooth mask (remove noise)
-        //cv::Mat kernel = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(4,4), cv::Point(0,0));
-        cv::Mat kernel = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(5,5), cv::Point(0,0));
-        cv::morphologyEx(mask, mask, cv::MORPH_OPEN, kernel);
-        cv::morphologyEx(mask, mask, cv::MORPH_CLOSE, kernel);
+template<typename T>
+void HOFSub::applyRows(const cv::Mat &input_image, cv::Mat *mask, const double &learning_rate, RowBand &band) {
+    const bool packed = this->model->getLayout() == SampleModel::PACKED;
+    const bool planar = packed || this->model->getLayout() == SampleModel::PLANAR;
+    const bool fixed = this->state->getPrecision() == PixelState::FIXED;
+    unsigned char *input_vals = band.byteRow(0, input_image.cols);
+    unsigned char *row_radius = band.byteRow(1, input_image.cols);
+    unsigned char *row_matches = band.byteRow(2, input_image.cols);
+    unsigned char *row_min_dist = band.byteRow(3, input_image.cols);
+    unsigned char *row_background = band.byteRow(4, input_image.cols);
+    unsigned char *unpacked = band.byteRow(5, packed ? input_image.cols : 0);
+    float *distance_buffer = band.floatRow(0, input_image.cols);
+    float *threshold_buffer = band.floatRow(1, input_image.cols);
+    float *update_buffer = band.floatRow(2, input_image.cols);
+
+    AdaptationParams params;
+    params.learning_rate = learning_rate;
+    params.req_matches = REQ_MATCHES;
+    params.thresh_scale = THRESH_SCALE;
+    params.thresh_min = THRESH_MIN;
+    // Fixed point thresholds saturate, clamping keeps the stored and the
+    // computed values the same.
+    params.thresh_max = std::min(THRESH_MAX, this->state->maxValue(PixelState::THRESHOLD));
+    params.thresh_inc_rate = THRESH_INC_RATE;
+    params.thresh_dec_rate = THRESH_DEC_RATE;
+    params.update_min = UPDATE_MIN;
+    params.update_max = UPDATE_MAX;
+    params.update_inc_rate = UPDATE_INC_RATE;
+    params.update_dec_rate = UPDATE_DEC_RATE;
+
+    band.reserve(input_image.cols);
+    band.stats.reset(this->active.count(band.row_start, band.row_end));
+    for (int r = band.row_start; r < band.row_end; r++) {
+        const int row_offset = this->table.rowOffset(r);
+        const Span *row_begin = this->active.rowBegin(r);
+        const Span *row_end = this->active.rowEnd(r);
+        const unsigned char *input_row = input_image.ptr<unsigned char>(r);
+        T *distance_row = this->state->row<T>(PixelState::DISTANCE, r);
+        T *threshold_row = this->state->row<T>(PixelState::THRESHOLD, r);
+        uint32_t *update_threshold_row = this->state->updateThresholdRow(r);
+        float *row_distance = loadRow(distance_row, distance_buffer, row_begin, row_end, PixelState::DISTANCE);
+        float *row_threshold = loadRow(threshold_row, threshold_buffer, row_begin, row_end, PixelState::THRESHOLD);
+        float *row_update = update_buffer;
+        if (fixed) {
+            loadUpdates(update_threshold_row, update_buffer, row_begin, row_end);
+        } else {
+            row_update = this->state->row<float>(PixelState::UPDATE, r);
+        }
 
-        mask.copyTo(fgmask);
+        // Distances are whole numbers, so matching against the float
+        // threshold is the same as matching against its integer part.
+        for (const Span *span = row_begin; span != row_end; span++) {
+            for (int c = span->start; c < span->end; c++) {
+                input_vals[c] = input_row[c] * this->color_reduction;
+                row_radius[c] = row_threshold[c] >= 255 ? 255 : static_cast<unsigned char>(row_threshold[c]);
+                row_matches[c] = 0;
+                row_min_dist[c] = 255;
+            }
+        }
 
-        // Find Convex Hull
-        std::vector<std::vector<cv::Point>> contours;
-        std::vector<cv::Vec4i> hierarchy;
-        cv::findContours(mask, contours, hierarchy, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
-        std::vector<std::vector<cv::Point>> hull(contours.size());
-        for (unsigned int i = 0; i < contours.size(); i++) {
-            cv::convexHull(cv::Mat(contours[i]), hull[i], false);
-            cv::drawContours(fgmask, hull, i, cv::Scalar(100), CV_FILLED);
+        if (planar) {
+            // Stream the row one sample plane at a time.
+            const unsigned char *plane_row = this->model->row(r);
+            for (int z = 0; z < this->history; z++, plane_row += this->model->getSampleStep()) {
+                const unsigned char *plane = plane_row;
+                for (const Span *span = row_begin; span != row_end; span++) {
+                    if (packed) {
+                        // Packed rows can only be entered at a block boundary.
+                        const int start = span->start - span->start % SampleModel::PACKED_BLOCK;
+                        unpackNibbleRow(plane_row + start / 2, span->end - start, unpacked + start);
+                        plane = unpacked;
+                    }
+                    const int c = span->start;
+                    accumulateDistances(plane + c, input_vals + c, row_radius + c, span->end - c, row_matches + c, row_min_dist + c);
+                }
+            }
+        } else {
+            for (const Span *span = row_begin; span != row_end; span++) {
+                for (int c = span->start; c < span->end; c++) {
+                    accumulatePixelDistances(this->model->pixel(r,c), this->history, input_vals[c], row_radius[c], row_matches + c, row_min_dist + c);
+                }
+            }
+        }
+
+        // All of the pixel state is updated here, in one pass.
+        for (const Span *span = row_begin; span != row_end; span++) {
+            const int c = span->start;
+            adaptStateRow(row_min_dist + c, row_matches + c, span->end - c, params, row_distance + c, row_threshold + c, row_update + c, update_threshold_row + c, row_background + c);
+        }
+        storeRow(distance_row, row_distance, row_begin, row_end, PixelState::DISTANCE);
+        storeRow(threshold_row, row_threshold, row_begin, row_end, PixelState::THRESHOLD);
+
+        // Update model
+        for (const Span *span = row_begin; span != row_end; span++) {
+            for (int c = span->start; c < span->end; c++) {
+                if (row_background[c]) {
+                    // Set foreground mask to zero.
+                    if (mask != NULL) {
+                        mask->at<unsigned char>(r,c) = 0;
+                    }
+                    updateModel(r, c, input_vals[c], row_offset + c, band);
+                } else {
+                    band.stats.add(r, c);
+                }
+            }
         }
+
+        flushRow(band);
     }
 }
 
@@ -245,33 +422,32 @@ void HOFSub::getBackgroundImage(cv::OutputArray background_image) const {
 
     for (int r = 0; r < this->rows; r++) {
         for (int c = 0; c < this->cols; c++) {
-            output.at<unsigned char>(r,c) = this->model->at<unsigned char>(r,c,2) * this->color_expansion;
+            output.at<unsigned char>(r,c) = this->model->get(r,c,2) * this->color_expansion;
         }
     }
 }
 
 void HOFSub::initiateModel(cv::Mat &image, cv::Rect &random_init) {
-    boost::random::uniform_int_distribution<int> random_row(0, image.rows-1);
-    boost::random::uniform_int_distribution<int> random_col(0, image.cols-1);
     for (int r = 0; r < image.rows; r++) {
         for (int c = 0; c < image.cols; c++) {
+            const uint32_t pixel = r * image.cols + c;
             if (!random_init.contains(cv::Point(c,r))) {
                 for (int z = 0; z < this->REQ_MATCHES; z++) {
-                    this->model->at<unsigned char>(r,c,z) = image.at<unsigned char>(r,c) * this->color_reduction;
+                    this->model->set(r, c, z, image.at<unsigned char>(r,c) * this->color_reduction);
                 }
                 for (int z = this->REQ_MATCHES; z < this->history; z++) {
-                    this->num_generated += 2;
-                    int row = random_row(*(this->gen));
-                    int col = random_col(*(this->gen));
-                    this->model->at<unsigned char>(r,c,z) = image.at<unsigned char>(row,col);
+                    const uint64_t bits = this->rng(CounterRNG::INIT_FRAME, pixel, z);
+                    int row = CounterRNG::uniform(static_cast<uint32_t>(bits), image.rows);
+                    int col = CounterRNG::uniform(static_cast<uint32_t>(bits >> 32), image.cols);
+                    this->model->set(r, c, z, image.at<unsigned char>(row,col) * this->color_reduction);
                 }
             } else {
                 // And values randomly from outside the rect
                 for (int z = 0; z < this->history; z++) {
-                    this->num_generated += 2;
-                    int row = random_row(*(this->gen));
-                    int col = random_col(*(this->gen));
-                    this->model->at<unsigned char>(r,c,z) = image.at<unsigned char>(row,col);
+                    const uint64_t bits = this->rng(CounterRNG::INIT_FRAME, pixel, z);
+                    int row = CounterRNG::uniform(static_cast<uint32_t>(bits), image.rows);
+                    int col = CounterRNG::uniform(static_cast<uint32_t>(bits >> 32), image.cols);
+                    this->model->set(r, c, z, image.at<unsigned char>(row,col) * this->color_reduction);
                 }
             }
         }
@@ -282,26 +458,54 @@ void HOFSub::read(const cv::FileNode &node) {
     //Load New Matrices
     cv::Mat temp;
     node["MODEL"] >> temp;
-    this->model = new cv::Mat(temp);
+    int layout;
+    node["LAYOUT"] >> layout;
+    this->model = new SampleModel();
+    const bool samples_read = this->model->fromMat(temp, layout);
+
+    //Update Values
+    node["ROWS"] >> this->rows;
+    node["COLS"] >> this->cols;
+
+    // Older checkpoints have no precision and were float
+    int precision = PixelState::FLOAT;
+    if (!node["PRECISION"].empty()) {
+        node["PRECISION"] >> precision;
+    }
+    this->state = new PixelState(this->rows, this->cols, precision);
+    // Same border as a new model, see the constructor. Fields missing from
+    // the file keep the values of a new model.
+    this->state->fill(PixelState::THRESHOLD, THRESH_MIN);
+    this->state->fill(PixelState::UPDATE, UPDATE_MAX);
+    this->state->fromMat(PixelState::UPDATE, cv::Mat(this->rows, this->cols, CV_32F, cv::Scalar(UPDATE_MIN)));
     cv::Mat temp0;
     node["DECISION_DIST"] >> temp0;
-    this->decision_distance = new cv::Mat(temp0);
+    this->state->fromMat(PixelState::DISTANCE, temp0);
     cv::Mat temp1;
     node["THRESHOLD"] >> temp1;
-    this->threshold = new cv::Mat(temp1);
+    this->state->fromMat(PixelState::THRESHOLD, temp1);
     cv::Mat temp2;
     node["UPDATE_VAL"] >> temp2;
-    this->update_val = new cv::Mat(temp2);
+    this->state->fromMat(PixelState::UPDATE, temp2);
 
-    //Update Values
-    node["ROWS"] >> this->rows;
-    node["COLS"] >> this->cols;
     node["COLORS"] >> this->colors;
     node["HISTORY"] >> this->history;
     node["COLOR_REDUCTION"] >> this->color_reduction;
     node["COLOR_EXPANSION"] >> this->color_expansion;
     node["INITIATED"] >> this->initiated;
-    node["NUM_GENERATED"] >> this->num_generated;
+    node["SEED"] >> this->seed;
+    node["FRAME"] >> this->frame;
+    if (!samples_read) {
+        // Without samples the model starts over with the next frame
+        this->model = new SampleModel(this->rows, this->cols, this->history, layout);
+        this->initiated = false;
+    }
+    this->rng = CounterRNG(this->seed);
+    this->table = RandomTable(this->seed, this->cols, this->history);
+
+    int threads;
+    node["THREADS"] >> threads;
+    setThreads(threads > 0 ? threads : 1);
 }
 
 void HOFSub::write(cv::FileStorage &fs) const {
@@ -313,14 +517,74 @@ void HOFSub::write(cv::FileStorage &fs) const {
     fs << "COLOR_REDUCTION" << this->color_reduction;
     fs << "COLOR_EXPANSION" << this->color_expansion;
     fs << "INITIATED" << this->initiated;
-    fs << "NUM_GENERATED" << this->num_generated;
-    fs << "MODEL" << *(this->model);
-    fs << "DECISION_DIST" << *(this->decision_distance);
-    fs << "THRESHOLD" << *(this->threshold);
-    fs << "UPDATE_VAL" << *(this->update_val);
+    fs << "SEED" << this->seed;
+    fs << "FRAME" << this->frame;
+    fs << "THREADS" << this->threads;
+    cv::Mat temp;
+    this->model->toMat(temp);
+    fs << "LAYOUT" << this->model->getLayout();
+    fs << "MODEL" << temp;
+    fs << "PRECISION" << this->state->getPrecision();
+    cv::Mat temp0, temp1, temp2;
+    this->state->toMat(PixelState::DISTANCE, temp0);
+    this->state->toMat(PixelState::THRESHOLD, temp1);
+    this->state->toMat(PixelState::UPDATE, temp2);
+    fs << "DECISION_DIST" << temp0;
+    fs << "THRESHOLD" << temp1;
+    fs << "UPDATE_VAL" << temp2;
     fs << "}";
 }
 
+bool HOFSub::readBinary(CheckpointReader &reader) {
+    int layout, precision, threads;
+    const bool read = reader.read("ROWS", this->rows)
+        && reader.read("COLS", this->cols)
+        && reader.read("COLORS", this->colors)
+        && reader.read("HISTORY", this->history)
+        && reader.read("COLOR_REDUCTION", this->color_reduction)
+        && reader.read("COLOR_EXPANSION", this->color_expansion)
+        && reader.read("INITIATED", this->initiated)
+        && reader.read("SEED", this->seed)
+        && reader.read("FRAME", this->frame)
+        && reader.read("THREADS", threads)
+        && reader.read("LAYOUT", layout)
+        && reader.read("PRECISION", precision);
+    if (!read) {
+        return false;
+    }
+
+    // Samples and pixel state are stored as they are in memory, update
+    // thresholds included.
+    cv::Ptr<SampleModel> model = new SampleModel(this->rows, this->cols, this->history, layout);
+    cv::Ptr<PixelState> state = new PixelState(this->rows, this->cols, precision);
+    if (!reader.read("MODEL", model->data(), model->dataSize()) || !reader.read("STATE", state->data(), state->dataSize())) {
+        return false;
+    }
+    this->model = model;
+    this->state = state;
+    this->rng = CounterRNG(this->seed);
+    this->table = RandomTable(this->seed, this->cols, this->history);
+    setThreads(threads > 0 ? threads : 1);
+    return true;
+}
+
+void HOFSub::writeBinary(CheckpointWriter &writer) const {
+    writer.write("ROWS", this->rows);
+    writer.write("COLS", this->cols);
+    writer.write("COLORS", this->colors);
+    writer.write("HISTORY", this->history);
+    writer.write("COLOR_REDUCTION", this->color_reduction);
+    writer.write("COLOR_EXPANSION", this->color_expansion);
+    writer.write("INITIATED", this->initiated);
+    writer.write("SEED", this->seed);
+    writer.write("FRAME", this->frame);
+    writer.write("THREADS", this->threads);
+    writer.write("LAYOUT", this->model->getLayout());
+    writer.write("PRECISION", this->state->getPrecision());
+    writer.write("MODEL", this->model->data(), this->model->dataSize());
+    writer.write("STATE", this->state->data(), this->state->dataSize());
+}
+
 std::ostream& HOFSub::print(std::ostream &out) const {
     out << "{ ";
     out << "rows = " << this->rows << ", ";
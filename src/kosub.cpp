@@ -10,7 +10,8 @@ KOSub::KOSub(
         const int rows,
         const int cols,
         const int colors,
-        const int radius
+        const int radius,
+        const size_t memory_limit
         ) {
     this->rows = rows;
     this->cols = cols;
@@ -19,9 +20,38 @@ KOSub::KOSub(
 
     this->color_reduction = static_cast<float>(this->colors)/this->max_colors;
     this->color_expansion = static_cast<float>(this->max_colors)/this->colors;
+    for (int i = 0; i < this->max_colors; i++) {
+        this->quantize[i] = floor(this->color_reduction * i);
+    }
+
+    // Most accurate representation within the memory limit
+    this->bins = 0;
+    if (memory_limit == 0 || modelSize(this->rows, this->cols, this->colors, DENSE) <= memory_limit) {
+        this->representation = DENSE;
+    } else if (modelSize(this->rows, this->cols, this->colors, DENSE_16) <= memory_limit) {
+        this->representation = DENSE_16;
+    } else {
+        this->representation = TOP_BINS;
+        const size_t pixel_size = modelSize(1, 1, this->colors, TOP_BINS, 1);
+        const size_t pixels = std::max(static_cast<size_t>(this->rows) * this->cols, static_cast<size_t>(1));
+        this->bins = std::min(static_cast<size_t>(this->colors), memory_limit / pixels / pixel_size);
+        LOG_IF(ERROR, this->bins == 0) << "A single bin per pixel does not fit in " << memory_limit << " bytes.";
+        this->bins = std::max(this->bins, 1);
+    }
+    VLOG(1) << "KOSub model " << this->representation << " with " << this->bins << " bins, " << modelSize(this->rows, this->cols, this->colors, this->representation, this->bins) << " bytes";
 
     int sizes[] = {this->rows, this->cols, this->colors};
-    this->model = new cv::Mat(3, sizes, CV_32F, cv::Scalar(0));
+    if (this->representation == DENSE) {
+        this->model = new cv::Mat(3, sizes, CV_32F, cv::Scalar(0));
+    } else if (this->representation == DENSE_16) {
+        this->model = new cv::Mat(3, sizes, CV_16U, cv::Scalar(0));
+    } else {
+        this->model = new cv::Mat();
+        this->bin_colors = cv::Mat(this->rows, this->cols * this->bins, CV_8U, cv::Scalar(0));
+        this->bin_weights = cv::Mat(this->rows, this->cols * this->bins, CV_16U, cv::Scalar(0));
+        this->in_bins.assign(this->colors, 0);
+        this->marked_colors.resize(this->bins);
+    }
     this->background_image = new cv::Mat(this->rows, this->cols, CV_8U, cv::Scalar(0));
     this->diff = new cv::Mat(this->rows, this->cols, CV_32F, cv::Scalar(0));
 }
@@ -38,41 +68,208 @@ KOSub::~KOSub() {
 }
 
 void KOSub::apply(cv::InputArray image, cv::OutputArray fgmask, double learning_rate) {
+    classify(image, learning_rate, NULL);
+
+    if (fgmask.needed()) {
+        cv::Mat char_mat;
+        diff->convertTo(char_mat, CV_8U, 255.0);
+        fgmask.create(diff->size(), CV_8U);
+        cv::threshold(char_mat, fgmask, FOREGROUND_THRESHOLD, 255, cv::THRESH_BINARY);
+    }
+}
+
+void KOSub::applyStats(cv::InputArray image, ForegroundStats &stats, double learning_rate) {
+    classify(image, learning_rate, &stats);
+}
+
+void KOSub::classify(cv::InputArray image, const double &learning_rate, ForegroundStats *stats) {
     cv::Mat input_image = image.getMat();
     if (input_image.channels() == 3) {
         cv::cvtColor(input_image, input_image, CV_BGR2GRAY);
     }
+    updateActiveSpans(input_image.size());
+    if (stats != NULL) {
+        stats->reset(this->active.count());
+    }
 
+    LOG_IF(ERROR, this->radius <= 0) << "Radius was set to zero.";
+    const int radius = this->radius;
+    const float window_area = radius * radius * 4;
+
+    // Color densities of the (2*radius)^2 window around every pixel, kept
+    // up to date with running sums over the quantized frame so the cost per
+    // pixel does not depend on the radius.
+    this->quantized.create(input_image.rows, input_image.cols, CV_8U);
     for (int r = 0; r < input_image.rows; r++) {
+        const unsigned char *p = input_image.ptr<unsigned char>(r);
+        unsigned char *q = this->quantized.ptr<unsigned char>(r);
         for (int c = 0; c < input_image.cols; c++) {
+            q[c] = this->quantize[p[c]];
+        }
+    }
+    this->column_counts.assign(input_image.cols * this->colors, 0);
+    this->window_counts.resize(this->colors);
+
+    // Windows cover rows r-radius to r+radius-1, clipped to the image.
+    for (int r = 0; r < std::min(radius - 1, input_image.rows); r++) {
+        countRow(r, 1);
+    }
+    for (int r = 0; r < input_image.rows; r++) {
+        if (r + radius - 1 >= 0 && r + radius - 1 < input_image.rows) {
+            countRow(r + radius - 1, 1);
+        }
+        if (r - radius - 1 >= 0) {
+            countRow(r - radius - 1, -1);
+        }
+        const Span *row_begin = this->active.rowBegin(r);
+        const Span *row_end = this->active.rowEnd(r);
+        if (row_begin == row_end) {
+            continue;
+        }
+
+        std::fill(this->window_counts.begin(), this->window_counts.end(), 0);
+        for (int c = 0; c < std::min(radius - 1, input_image.cols); c++) {
+            countColumn(c, 1);
+        }
+        const Span *span = row_begin;
+        for (int c = 0; c < input_image.cols && span != row_end; c++) {
+            if (c + radius - 1 >= 0 && c + radius - 1 < input_image.cols) {
+                countColumn(c + radius - 1, 1);
+            }
+            if (c - radius - 1 >= 0) {
+                countColumn(c - radius - 1, -1);
+            }
+            if (c < span->start) {
+                continue;
+            }
+
             unsigned char bg_color = 0;
-            float max_freq = 0;
-            float val = 0;
-            for (int z = 0; z < this->colors; z++) {
-                LOG_IF(ERROR, this->radius <= 0) << "Radius was set to zero.";
-                float new_val = densityNeighborhood(input_image, r, c, z, this->radius);
-                float prev_val = model->at<float>(r,c,z);
-                val += new_val * prev_val;
-                model->at<float>(r,c,z) = ((1-learning_rate) * prev_val) + (learning_rate * new_val);
-                if (model->at<float>(r,c,z) > max_freq) {
-                    bg_color = z;
-                }
+            float val;
+            if (this->representation == DENSE) {
+                val = updateDense(r, c, learning_rate, window_area, bg_color);
+            } else if (this->representation == DENSE_16) {
+                val = updateDense16(r, c, learning_rate, window_area, bg_color);
+            } else {
+                val = updateTopBins(r, c, learning_rate, window_area, bg_color);
             }
             this->background_image->at<unsigned char>(r,c) = bg_color * this->color_expansion;
             diff->at<float>(r,c) = 1-sqrt(val);
+            // Same rounding as the 8-bit mask in apply()
+            if (stats != NULL && cv::saturate_cast<unsigned char>(255.0 * diff->at<float>(r,c)) > FOREGROUND_THRESHOLD) {
+                stats->add(r, c);
+            }
+
+            if (c + 1 == span->end) {
+                span++;
+            }
         }
     }
+}
 
-    if (fgmask.needed()) {
-        cv::Mat char_mat;
-        diff->convertTo(char_mat, CV_8U, 255.0);
-        fgmask.create(input_image.size(), input_image.type());
-        cv::threshold(char_mat, fgmask, 150, 255, cv::THRESH_BINARY);
+float KOSub::updateDense(const int r, const int c, const double &learning_rate, const float &window_area, unsigned char &bg_color) {
+    float *densities = this->model->ptr<float>(r, c);
+    float max_freq = 0;
+    float val = 0;
+    for (int z = 0; z < this->colors; z++) {
+        float new_val = this->window_counts[z] / window_area;
+        float prev_val = densities[z];
+        val += new_val * prev_val;
+        densities[z] = ((1-learning_rate) * prev_val) + (learning_rate * new_val);
+        if (densities[z] > max_freq) {
+            bg_color = z;
+        }
+    }
+    return val;
+}
+
+float KOSub::updateDense16(const int r, const int c, const double &learning_rate, const float &window_area, unsigned char &bg_color) {
+    uint16_t *densities = this->model->ptr<uint16_t>(r, c);
+    float val = 0;
+    for (int z = 0; z < this->colors; z++) {
+        float new_val = this->window_counts[z] / window_area;
+        float prev_val = decodeWeight(densities[z]);
+        val += new_val * prev_val;
+        densities[z] = blendWeight(densities[z], new_val, learning_rate);
+        if (densities[z] > 0) {
+            bg_color = z;
+        }
+    }
+    return val;
+}
+
+float KOSub::updateTopBins(const int r, const int c, const double &learning_rate, const float &window_area, unsigned char &bg_color) {
+    unsigned char *colors = this->bin_colors.ptr<unsigned char>(r) + c * this->bins;
+    uint16_t *weights = this->bin_weights.ptr<uint16_t>(r) + c * this->bins;
+
+    // Colors missing from the bins have a density of zero, they add nothing
+    // to the correlation.
+    float val = 0;
+    int marked = 0;
+    for (int k = 0; k < this->bins; k++) {
+        if (weights[k] == 0) {
+            continue;
+        }
+        float new_val = this->window_counts[colors[k]] / window_area;
+        float prev_val = decodeWeight(weights[k]);
+        val += new_val * prev_val;
+        weights[k] = blendWeight(weights[k], new_val, learning_rate);
+        this->in_bins[colors[k]] = 1;
+        this->marked_colors[marked++] = colors[k];
+    }
+
+    // New colors take the place of the weakest bin if they are stronger.
+    // Like the window counts this looks at every color, the bins only save
+    // the blending and the memory.
+    for (int z = 0; z < this->colors; z++) {
+        if (this->window_counts[z] == 0 || this->in_bins[z]) {
+            continue;
+        }
+        const uint16_t weight = encodeWeight(learning_rate * (this->window_counts[z] / window_area));
+        int weakest = 0;
+        for (int k = 1; k < this->bins; k++) {
+            if (weights[k] < weights[weakest]) {
+                weakest = k;
+            }
+        }
+        if (weight > weights[weakest]) {
+            colors[weakest] = z;
+            weights[weakest] = weight;
+        }
+    }
+
+    // Evicted colors were marked too, so the marks are cleared by the list
+    // rather than by the bins.
+    for (int i = 0; i < marked; i++) {
+        this->in_bins[this->marked_colors[i]] = 0;
+    }
+    for (int k = 0; k < this->bins; k++) {
+        if (weights[k] > 0 && colors[k] >= bg_color) {
+            bg_color = colors[k];
+        }
+    }
+    return val;
+}
+
+int KOSub::getRepresentation() const {
+    return this->representation;
+}
+
+int KOSub::getBins() const {
+    return this->bins;
+}
+
+size_t KOSub::modelSize(const int rows, const int cols, const int colors, const int representation, const int bins) {
+    const size_t pixels = static_cast<size_t>(rows) * cols;
+    if (representation == DENSE) {
+        return pixels * colors * sizeof(float);
+    } else if (representation == DENSE_16) {
+        return pixels * colors * sizeof(uint16_t);
     }
+    return pixels * bins * (sizeof(unsigned char) + sizeof(uint16_t));
 }
 
 void KOSub::getBackgroundImage(cv::OutputArray background_image) const {
-    if (!background_image.needed() || model->empty()) {
+    if (!background_image.needed() || this->background_image->empty()) {
         VLOG(1) << "Background was empty";
         return;
     }
@@ -0,0 +1,188 @@
+#include "mansub.hpp"
+#include "bsub_kernels.hpp"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <opencv2/imgproc/imgproc.hpp>
+
+MANSub::MANSub(
+        const int rows,
+        const int cols,
+        const int amplification,
+        const int min_variance,
+        const int max_variance
+        ) {
+    LOG_IF(ERROR, amplification <= 0) << "Amplification has to be positive.";
+    LOG_IF(ERROR, min_variance < 0 || max_variance > 255 || min_variance > max_variance) << "Variance limits have to be within 0 and 255.";
+
+    this->initiated = false;
+    this->rows = rows;
+    this->cols = cols;
+    this->amplification = amplification > 0 ? amplification : 1;
+    this->min_variance = std::min(std::max(min_variance, 0), 255);
+    this->max_variance = std::min(std::max(max_variance, this->min_variance), 255);
+
+    this->variance = new cv::Mat();
+}
+
+MANSub::MANSub(const MANSub &other) : BSub(other) {
+    this->initiated = other.initiated;
+    this->rows = other.rows;
+    this->cols = other.cols;
+    this->amplification = other.amplification;
+    this->min_variance = other.min_variance;
+    this->max_variance = other.max_variance;
+
+    this->variance = other.variance;
+}
+
+MANSub::~MANSub() {
+}
+
+//Only supports 8-bit images
+void MANSub::operator()(cv::InputArray image, cv::OutputArray fgmask, double learning_rate) {
+    this->apply(image, fgmask, learning_rate);
+}
+
+void MANSub::apply(cv::InputArray image, cv::OutputArray fgmask, double) {
+    if (fgmask.needed()) {
+        fgmask.create(image.getMat().size(), CV_8U);
+        cv::Mat mask = fgmask.getMat();
+        classify(image, &mask, NULL);
+    } else {
+        classify(image, NULL, NULL);
+    }
+}
+
+void MANSub::applyStats(cv::InputArray image, ForegroundStats &stats, double) {
+    classify(image, NULL, &stats);
+}
+
+void MANSub::classify(cv::InputArray image, cv::Mat *mask, ForegroundStats *stats) {
+    cv::Mat input_image = image.getMat();
+    if (input_image.channels() == 3) {
+        cv::cvtColor(input_image, this->gray, CV_BGR2GRAY);
+        input_image = this->gray;
+    }
+    LOG_IF(WARNING, input_image.rows != this->rows || input_image.cols != this->cols) << "Different size image: " << input_image.size() << " vs " << cv::Size(this->cols, this->rows);
+
+    if (!this->initiated || this->model->size() != input_image.size()) {
+        input_image.copyTo(*(this->model));
+        this->variance->create(input_image.size(), CV_8U);
+        *(this->variance) = cv::Scalar(this->min_variance);
+        this->rows = input_image.rows;
+        this->cols = input_image.cols;
+        this->initiated = true;
+    }
+    updateActiveSpans(input_image.size());
+
+    if (mask != NULL && !this->active.full()) {
+        *mask = cv::Scalar(0);
+    }
+    if (stats != NULL) {
+        stats->reset(this->active.count());
+        this->row_mask.resize(input_image.cols);
+    }
+
+    for (int r = 0; r < input_image.rows; r++) {
+        const unsigned char *input_row = input_image.ptr<unsigned char>(r);
+        unsigned char *background_row = this->model->ptr<unsigned char>(r);
+        unsigned char *variance_row = this->variance->ptr<unsigned char>(r);
+        unsigned char *mask_row = NULL;
+        if (mask != NULL) {
+            mask_row = mask->ptr<unsigned char>(r);
+        } else if (stats != NULL) {
+            mask_row = this->row_mask.data();
+        }
+        for (const Span *span = this->active.rowBegin(r); span != this->active.rowEnd(r); span++) {
+            const int c = span->start;
+            sigmaDeltaRow(input_row + c, background_row + c, variance_row + c, span->end - c, this->amplification, this->min_variance, this->max_variance, mask_row == NULL ? NULL : mask_row + c);
+            if (stats != NULL) {
+                for (int i = span->start; i < span->end; i++) {
+                    if (mask_row[i]) {
+                        stats->add(r, i);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void MANSub::getBackgroundImage(cv::OutputArray background_image) const {
+    if (!background_image.needed() || this->model->empty()) {
+        VLOG(1) << "Background was empty";
+        return;
+    }
+
+    background_image.create(this->model->size(), CV_8U);
+    cv::Mat output = background_image.getMat();
+    this->model->copyTo(output);
+}
+
+void MANSub::read(const cv::FileNode &node) {
+    //Load New Matrices
+    cv::Mat temp0;
+    node["MODEL"] >> temp0;
+    this->model = new cv::Mat(temp0);
+    cv::Mat temp1;
+    node["VARIANCE"] >> temp1;
+    this->variance = new cv::Mat(temp1);
+
+    //Update Values
+    node["ROWS"] >> this->rows;
+    node["COLS"] >> this->cols;
+    node["AMPLIFICATION"] >> this->amplification;
+    node["MIN_VARIANCE"] >> this->min_variance;
+    node["MAX_VARIANCE"] >> this->max_variance;
+    node["INITIATED"] >> this->initiated;
+}
+
+void MANSub::write(cv::FileStorage &fs) const {
+    fs << "{";
+    fs << "ROWS" << this->rows;
+    fs << "COLS" << this->cols;
+    fs << "AMPLIFICATION" << this->amplification;
+    fs << "MIN_VARIANCE" << this->min_variance;
+    fs << "MAX_VARIANCE" << this->max_variance;
+    fs << "INITIATED" << this->initiated;
+    fs << "MODEL" << *(this->model);
+    fs << "VARIANCE" << *(this->variance);
+    fs << "}";
+}
+
+bool MANSub::readBinary(CheckpointReader &reader) {
+    cv::Mat temp0, temp1;
+    if (!reader.read("MODEL", temp0) || !reader.read("VARIANCE", temp1) || temp0.size() != temp1.size()) {
+        return false;
+    }
+    this->model = new cv::Mat(temp0);
+    this->variance = new cv::Mat(temp1);
+
+    return reader.read("ROWS", this->rows)
+        && reader.read("COLS", this->cols)
+        && reader.read("AMPLIFICATION", this->amplification)
+        && reader.read("MIN_VARIANCE", this->min_variance)
+        && reader.read("MAX_VARIANCE", this->max_variance)
+        && reader.read("INITIATED", this->initiated);
+}
+
+void MANSub::writeBinary(CheckpointWriter &writer) const {
+    writer.write("ROWS", this->rows);
+    writer.write("COLS", this->cols);
+    writer.write("AMPLIFICATION", this->amplification);
+    writer.write("MIN_VARIANCE", this->min_variance);
+    writer.write("MAX_VARIANCE", this->max_variance);
+    writer.write("INITIATED", this->initiated);
+    writer.write("MODEL", *(this->model));
+    writer.write("VARIANCE", *(this->variance));
+}
+
+std::ostream& MANSub::print(std::ostream &out) const {
+    out << "{ ";
+    out << "rows = " << this->rows << ", ";
+    out << "cols = " << this->cols << ", ";
+    out << "amplification = " << this->amplification;
+    out << " }";
+    return out;
+}
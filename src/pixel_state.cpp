@@ -0,0 +1,90 @@
+#include "pixel_state.hpp"
+
+#include <glog/logging.h>
+
+#include <limits>
+
+// Distances stay below 256 (8.8), thresholds below 2048 (11.5).
+const float PixelState::FIXED_ONE[] = {256.0f, 32.0f};
+const float PixelState::FIXED_SCALE[] = {1.0f / 256.0f, 1.0f / 32.0f};
+
+PixelState::PixelState(const int rows, const int cols, const int precision) {
+    LOG_IF(ERROR, precision != FLOAT && precision != FIXED) << "Unknown precision " << precision << ", using float.";
+    this->rows = rows;
+    this->cols = cols;
+    this->precision = precision == FIXED ? FIXED : FLOAT;
+    this->stored_fields = this->precision == FIXED ? UPDATE : NUM_FIELDS;
+
+    const size_t value_size = this->precision == FIXED ? sizeof(uint16_t) : sizeof(float);
+    this->field_step = cv::alignSize(BORDER + (this->cols + 1) * value_size, ALIGNMENT);
+    const ptrdiff_t threshold_step = cv::alignSize(BORDER + (this->cols + 1) * sizeof(uint32_t), ALIGNMENT);
+    this->row_step = this->field_step * this->stored_fields + threshold_step;
+    const size_t bytes = this->row_step * (this->rows + 2);
+
+    // Over allocate so the first row can start on an aligned address.
+    this->storage = cv::Mat(1, bytes + ALIGNMENT, CV_8U, cv::Scalar(0));
+    this->origin = cv::alignPtr(this->storage.data, ALIGNMENT) + this->row_step + BORDER;
+}
+
+int PixelState::getRows() const {
+    return this->rows;
+}
+
+int PixelState::getCols() const {
+    return this->cols;
+}
+
+int PixelState::getPrecision() const {
+    return this->precision;
+}
+
+bool PixelState::empty() const {
+    return this->rows <= 0 || this->cols <= 0;
+}
+
+unsigned char* PixelState::data() const {
+    return cv::alignPtr(this->storage.data, ALIGNMENT);
+}
+
+size_t PixelState::dataSize() const {
+    return this->storage.cols - ALIGNMENT;
+}
+
+float PixelState::maxValue(const int field) const {
+    if (this->precision == FLOAT || field == UPDATE) {
+        return std::numeric_limits<float>::max();
+    }
+    return 65535 * FIXED_SCALE[field];
+}
+
+void PixelState::fill(const int field, const float value) {
+    for (int r = -1; r <= this->rows; r++) {
+        for (int c = -1; c <= this->cols; c++) {
+            set(field, r, c, value);
+        }
+    }
+}
+
+void PixelState::toMat(const int field, cv::Mat &output) const {
+    output.create(this->rows, this->cols, CV_32F);
+    for (int r = 0; r < this->rows; r++) {
+        float *out = output.ptr<float>(r);
+        for (int c = 0; c < this->cols; c++) {
+            out[c] = get(field, r, c);
+        }
+    }
+}
+
+bool PixelState::fromMat(const int field, const cv::Mat &input) {
+    if (input.rows != this->rows || input.cols != this->cols || input.type() != CV_32F) {
+        LOG(ERROR) << "Expected a " << this->rows << " x " << this->cols << " CV_32F matrix.";
+        return false;
+    }
+    for (int r = 0; r < this->rows; r++) {
+        const float *in = input.ptr<float>(r);
+        for (int c = 0; c < this->cols; c++) {
+            set(field, r, c, in[c]);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,35 @@
+#include "random_table.hpp"
+
+#include <glog/logging.h>
+
+// Offsets of the 8 neighbours in row major order
+static const signed char NEIGHBOR_ROWS[] = {-1, -1, -1, 0, 0, 1, 1, 1};
+static const signed char NEIGHBOR_COLS[] = {-1, 0, 1, -1, 1, -1, 0, 1};
+
+RandomTable::RandomTable(const uint32_t seed, const int cols, const int history, const int size) {
+    LOG_IF(ERROR, history > 256) << "History does not fit in the table slots.";
+
+    this->rng = CounterRNG(seed);
+    this->frame = 0;
+    this->cols = cols;
+    this->history = history;
+    this->size = size;
+
+    // Room for a full row after the largest offset.
+    this->updates.resize(this->size + this->cols);
+    this->decisions.resize(this->size + this->cols);
+}
+
+void RandomTable::fill(const uint32_t frame) {
+    this->frame = frame;
+    for (size_t i = 0; i < this->updates.size(); i++) {
+        const uint64_t bits = this->rng(frame, i, 0);
+        const uint64_t neighbor_bits = this->rng(frame, i, 1);
+        this->updates[i] = static_cast<uint32_t>(bits);
+        this->decisions[i].slot = CounterRNG::uniform(static_cast<uint32_t>(bits >> 32) << 3, this->history);
+        this->decisions[i].neighbor_row = NEIGHBOR_ROWS[bits >> 61];
+        this->decisions[i].neighbor_col = NEIGHBOR_COLS[bits >> 61];
+        this->decisions[i].neighbor_update = static_cast<uint32_t>(neighbor_bits);
+        this->decisions[i].neighbor_slot = CounterRNG::uniform(static_cast<uint32_t>(neighbor_bits >> 32), this->history);
+    }
+}
@@ -0,0 +1,110 @@
+#include "sample_model.hpp"
+
+#include <glog/logging.h>
+
+SampleModel::SampleModel(const int rows, const int cols, const int history, const int layout) {
+    this->rows = rows;
+    this->cols = cols;
+    this->history = history;
+    this->layout = layout;
+    allocate();
+}
+
+int SampleModel::getRows() const {
+    return this->rows;
+}
+
+int SampleModel::getCols() const {
+    return this->cols;
+}
+
+int SampleModel::getHistory() const {
+    return this->history;
+}
+
+int SampleModel::getLayout() const {
+    return this->layout;
+}
+
+cv::Size SampleModel::size() const {
+    return cv::Size(this->cols, this->rows);
+}
+
+bool SampleModel::empty() const {
+    return this->rows <= 0 || this->cols <= 0 || this->history <= 0;
+}
+
+unsigned char* SampleModel::data() const {
+    return cv::alignPtr(this->storage.data, ALIGNMENT);
+}
+
+size_t SampleModel::dataSize() const {
+    return this->storage.cols - ALIGNMENT;
+}
+
+void SampleModel::allocate() {
+    // One pixel border on every side of the image
+    size_t bytes;
+    ptrdiff_t border;
+    if (this->layout == PACKED) {
+        const int blocks = (this->cols + 1 + PACKED_BLOCK - 1) / PACKED_BLOCK;
+        this->row_step = cv::alignSize(PLANAR_BORDER + blocks * PACKED_BLOCK / 2, ALIGNMENT);
+        this->pixel_step = 0;
+        this->sample_step = this->row_step * (this->rows + 2);
+        bytes = this->sample_step * this->history;
+        border = this->row_step + PLANAR_BORDER;
+    } else if (this->layout == PLANAR) {
+        this->row_step = cv::alignSize(PLANAR_BORDER + this->cols + 1, ALIGNMENT);
+        this->pixel_step = 1;
+        this->sample_step = this->row_step * (this->rows + 2);
+        bytes = this->sample_step * this->history;
+        border = this->row_step + PLANAR_BORDER;
+    } else {
+        LOG_IF(ERROR, this->layout != INTERLEAVED) << "Unknown layout " << this->layout << ", using interleaved.";
+        this->layout = INTERLEAVED;
+        this->row_step = (this->cols + 2) * this->history;
+        this->pixel_step = this->history;
+        this->sample_step = 1;
+        bytes = this->row_step * (this->rows + 2);
+        border = this->row_step + this->pixel_step;
+    }
+
+    // Over allocate so the first plane can start on an aligned address.
+    this->storage = cv::Mat(1, bytes + ALIGNMENT, CV_8U, cv::Scalar(0));
+    this->origin = cv::alignPtr(this->storage.data, ALIGNMENT) + border;
+}
+
+void SampleModel::toMat(cv::Mat &output) const {
+    int sizes[] = {this->rows, this->cols, this->history};
+    output.create(3, sizes, CV_8U);
+    for (int r = 0; r < this->rows; r++) {
+        unsigned char *out = output.ptr<unsigned char>(r);
+        for (int c = 0; c < this->cols; c++) {
+            for (int z = 0; z < this->history; z++) {
+                *(out++) = get(r, c, z);
+            }
+        }
+    }
+}
+
+bool SampleModel::fromMat(const cv::Mat &input, const int layout) {
+    if (input.dims != 3 || input.type() != CV_8U) {
+        LOG(ERROR) << "Expected a rows x cols x history CV_8U matrix.";
+        return false;
+    }
+    this->rows = input.size[0];
+    this->cols = input.size[1];
+    this->history = input.size[2];
+    this->layout = layout;
+    allocate();
+
+    for (int r = 0; r < this->rows; r++) {
+        const unsigned char *in = input.ptr<unsigned char>(r);
+        for (int c = 0; c < this->cols; c++) {
+            for (int z = 0; z < this->history; z++) {
+                set(r, c, z, *(in++));
+            }
+        }
+    }
+    return true;
+}
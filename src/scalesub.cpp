@@ -0,0 +1,154 @@
+#include "scalesub.hpp"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <opencv2/imgproc/imgproc.hpp>
+
+ScaleSub::ScaleSub(const cv::Ptr<BSub> &subtractor, const int scale) {
+    LOG_IF(ERROR, scale <= 0) << "Scale has to be positive, using 1.";
+    this->subtractor = subtractor;
+    this->scale = scale > 0 ? scale : 1;
+}
+
+ScaleSub::~ScaleSub() {
+}
+
+int ScaleSub::getScale() const {
+    return this->scale;
+}
+
+cv::Size ScaleSub::scaledSize(const cv::Size &size, const int scale) {
+    return cv::Size(size.width / scale, size.height / scale);
+}
+
+//Only supports 8-bit images
+void ScaleSub::operator()(cv::InputArray image, cv::OutputArray fgmask, double learning_rate) {
+    this->apply(image, fgmask, learning_rate);
+}
+
+void ScaleSub::shrink(cv::InputArray image) {
+    cv::Mat input_image = image.getMat();
+    if (input_image.channels() == 3) {
+        cv::cvtColor(input_image, input_image, CV_BGR2GRAY);
+    }
+    this->input_size = input_image.size();
+    updateActiveSpans(this->input_size);
+    if (this->scale == 1) {
+        this->small_image = input_image;
+    } else {
+        // Area filter, exact pixel averages for integer factors
+        cv::resize(input_image, this->small_image, scaledSize(this->input_size, this->scale), 0, 0, cv::INTER_AREA);
+    }
+}
+
+void ScaleSub::apply(cv::InputArray image, cv::OutputArray fgmask, double learning_rate) {
+    shrink(image);
+    if (!fgmask.needed()) {
+        this->subtractor->operator()(this->small_image, cv::noArray(), learning_rate);
+        return;
+    }
+
+    this->subtractor->operator()(this->small_image, this->small_mask, learning_rate);
+    if (this->scale == 1) {
+        this->small_mask.copyTo(fgmask);
+    } else {
+        cv::resize(this->small_mask, fgmask, this->input_size, 0, 0, cv::INTER_NEAREST);
+    }
+    if (!this->active.full()) {
+        cv::Mat mask = fgmask.getMat();
+        this->active.clearExcluded(mask);
+    }
+}
+
+void ScaleSub::maintain(cv::InputArray image, double learning_rate) {
+    shrink(image);
+    this->subtractor->maintain(this->small_image, learning_rate);
+}
+
+void ScaleSub::applyStats(cv::InputArray image, ForegroundStats &stats, double learning_rate) {
+    shrink(image);
+    ForegroundStats small_stats;
+    this->subtractor->applyStats(this->small_image, small_stats, learning_rate);
+
+    // Every reduced pixel covers scale x scale input pixels.
+    const int area = this->scale * this->scale;
+    stats.reset(this->active.count());
+    stats.count = std::min(small_stats.count * area, stats.total);
+    if (small_stats.count > 0) {
+        stats.top = small_stats.top * this->scale;
+        stats.left = small_stats.left * this->scale;
+        stats.bottom = std::min((small_stats.bottom + 1) * this->scale, this->input_size.height) - 1;
+        stats.right = std::min((small_stats.right + 1) * this->scale, this->input_size.width) - 1;
+    }
+}
+
+void ScaleSub::getBackgroundImage(cv::OutputArray background_image) const {
+    cv::Mat small_background;
+    this->subtractor->getBackgroundImage(small_background);
+    if (!background_image.needed() || small_background.empty()) {
+        VLOG(1) << "Background was empty";
+        return;
+    }
+    cv::resize(small_background, background_image, this->input_size, 0, 0, cv::INTER_LINEAR);
+}
+
+void ScaleSub::setExclusionMask(const cv::Mat &mask) {
+    BSub::setExclusionMask(mask);
+
+    // A reduced pixel is only active when every pixel it covers is.
+    cv::Mat active_mask, small_active;
+    cv::compare(mask, 0, active_mask, cv::CMP_NE);
+    cv::resize(active_mask, small_active, scaledSize(mask.size(), this->scale), 0, 0, cv::INTER_AREA);
+    cv::compare(small_active, 255, small_active, cv::CMP_EQ);
+    this->subtractor->setExclusionMask(small_active);
+}
+
+void ScaleSub::read(const cv::FileNode &node) {
+    node["SCALE"] >> this->scale;
+    int width, height;
+    node["WIDTH"] >> width;
+    node["HEIGHT"] >> height;
+    this->input_size = cv::Size(width, height);
+    this->subtractor->read(node["SUBTRACTOR"]);
+}
+
+bool ScaleSub::readBinary(CheckpointReader &reader) {
+    int width, height;
+    if (!reader.read("SCALE", this->scale) || !reader.read("WIDTH", width) || !reader.read("HEIGHT", height)) {
+        return false;
+    }
+    this->input_size = cv::Size(width, height);
+    reader.beginGroup("SUBTRACTOR");
+    const bool read = this->subtractor->readBinary(reader);
+    reader.endGroup();
+    return read;
+}
+
+void ScaleSub::writeBinary(CheckpointWriter &writer) const {
+    writer.write("SCALE", this->scale);
+    writer.write("WIDTH", this->input_size.width);
+    writer.write("HEIGHT", this->input_size.height);
+    writer.beginGroup("SUBTRACTOR");
+    this->subtractor->writeBinary(writer);
+    writer.endGroup();
+}
+
+void ScaleSub::write(cv::FileStorage &fs) const {
+    fs << "{";
+    fs << "SCALE" << this->scale;
+    fs << "WIDTH" << this->input_size.width;
+    fs << "HEIGHT" << this->input_size.height;
+    fs << "SUBTRACTOR";
+    this->subtractor->write(fs);
+    fs << "}";
+}
+
+std::ostream& ScaleSub::print(std::ostream &out) const {
+    out << "{ ";
+    out << "scale = " << this->scale << ", ";
+    out << "subtractor = ";
+    this->subtractor->print(out);
+    out << " }";
+    return out;
+}
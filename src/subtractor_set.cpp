@@ -0,0 +1,108 @@
+#include "subtractor_set.hpp"
+
+#include <glog/logging.h>
+
+SubtractorSet::SubtractorSet(const std::vector<cv::Ptr<BSub> > &subtractors, const bool keep_masks, const int threads) {
+    this->subtractors = subtractors;
+    this->keep_masks = keep_masks;
+    this->masks.resize(subtractors.size());
+    this->counts.resize(subtractors.size(), 0);
+
+    this->frame = NULL;
+    this->frame_rate = 0;
+    this->first = 0;
+    this->maintaining = false;
+    setThreads(threads);
+}
+
+void SubtractorSet::setThreads(const int threads) {
+    LOG_IF(ERROR, threads <= 0) << "Number of threads has to be positive.";
+    this->threads = threads > 0 ? threads : 1;
+    if (this->threads > 1) {
+        this->pool = new ThreadPool(this->threads);
+    } else {
+        this->pool.release();
+    }
+}
+
+void SubtractorSet::apply(const size_t i, const cv::Mat &image, const double learning_rate) {
+    if (this->keep_masks) {
+        // The subtractors only reallocate the mask when the size changes.
+        this->subtractors[i]->operator()(image, this->masks[i], learning_rate);
+        this->counts[i] = cv::countNonZero(this->masks[i]);
+    } else {
+        ForegroundStats stats;
+        this->subtractors[i]->applyStats(image, stats, learning_rate);
+        this->counts[i] = stats.count;
+    }
+}
+
+void SubtractorSet::maintain(const size_t i, const cv::Mat &image, const double learning_rate) {
+    this->subtractors[i]->maintain(image, learning_rate);
+    if (this->keep_masks) {
+        this->masks[i].create(image.size(), CV_8U);
+        this->masks[i] = cv::Scalar(0);
+    }
+    this->counts[i] = 0;
+}
+
+void SubtractorSet::applyAll(const cv::Mat &image, const double learning_rate, const size_t first) {
+    runAll(image, learning_rate, first, false);
+}
+
+void SubtractorSet::maintainAll(const cv::Mat &image, const double learning_rate, const size_t first) {
+    runAll(image, learning_rate, first, true);
+}
+
+void SubtractorSet::runAll(const cv::Mat &image, const double learning_rate, const size_t first, const bool maintaining) {
+    if (first >= this->subtractors.size()) {
+        return;
+    }
+    this->frame = &image;
+    this->frame_rate = learning_rate;
+    this->first = first;
+    this->maintaining = maintaining;
+
+    const int tasks = this->subtractors.size() - first;
+    if (this->pool.empty() || tasks == 1) {
+        for (int i = 0; i < tasks; i++) {
+            runTask(i);
+        }
+    } else {
+        // Only capturing this keeps the task small enough for std::function
+        // to store it without allocating.
+        this->pool->run(tasks, [this](int i) {
+            runTask(i);
+        });
+    }
+    this->frame = NULL;
+}
+
+void SubtractorSet::runTask(const size_t i) {
+    if (this->maintaining) {
+        maintain(this->first + i, *(this->frame), this->frame_rate);
+    } else {
+        apply(this->first + i, *(this->frame), this->frame_rate);
+    }
+}
+
+size_t SubtractorSet::size() const {
+    return this->subtractors.size();
+}
+
+bool SubtractorSet::keepsMasks() const {
+    return this->keep_masks;
+}
+
+const cv::Ptr<BSub>& SubtractorSet::subtractor(const size_t i) const {
+    return this->subtractors[i];
+}
+
+const cv::Mat& SubtractorSet::mask(const size_t i) const {
+    LOG_IF(ERROR, !this->keep_masks) << "Masks are not kept.";
+    return this->masks[i];
+}
+
+int SubtractorSet::count(const size_t i) const {
+    return this->counts[i];
+}
@@ -0,0 +1,67 @@
+#include "thread_pool.hpp"
+
+#include <glog/logging.h>
+
+ThreadPool::ThreadPool(const int threads) {
+    LOG_IF(ERROR, threads <= 0) << "Thread pool needs at least one thread.";
+    this->task = NULL;
+    this->next_task = 0;
+    this->num_tasks = 0;
+    this->finished = 0;
+    this->stopping = false;
+    for (int i = 0; i < threads; i++) {
+        this->workers.push_back(std::thread(&ThreadPool::work, this));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->work_ready.notify_all();
+    for (size_t i = 0; i < this->workers.size(); i++) {
+        this->workers[i].join();
+    }
+}
+
+int ThreadPool::size() const {
+    return this->workers.size();
+}
+
+void ThreadPool::run(const int tasks, const std::function<void(int)> &task) {
+    if (tasks <= 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->task = &task;
+    this->next_task = 0;
+    this->num_tasks = tasks;
+    this->finished = 0;
+    this->work_ready.notify_all();
+    while (this->finished < this->num_tasks) {
+        this->work_done.wait(lock);
+    }
+    this->task = NULL;
+}
+
+void ThreadPool::work() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        while (!this->stopping && (this->task == NULL || this->next_task >= this->num_tasks)) {
+            this->work_ready.wait(lock);
+        }
+        if (this->stopping) {
+            return;
+        }
+        const int i = this->next_task++;
+        const std::function<void(int)> *current = this->task;
+        lock.unlock();
+        (*current)(i);
+        lock.lock();
+        this->finished++;
+        if (this->finished == this->num_tasks) {
+            this->work_done.notify_one();
+        }
+    }
+}
@@ -1,4 +1,5 @@
 #include "vansub.hpp"
+#include "bsub_kernels.hpp"
 
 #include <glog/logging.h>
 
@@ -10,9 +11,12 @@ VANSub::VANSub(
         const int cols,
         const int radius,
         const int colors,
-        const int history
+        const int history,
+        const int layout,
+        const int threads
         ) {
     LOG_IF(ERROR, history <= 0) << "History was set to zero.";
+    LOG_IF(ERROR, history > static_cast<int>(CounterRNG::MAX_DRAWS)) << "History is larger than the number of random draws per pixel.";
 
     this->initiated = false;
     this->rows = rows;
@@ -24,16 +28,20 @@ VANSub::VANSub(
     this->color_reduction = static_cast<float>(this->colors)/this->max_colors;
     this->color_expansion = static_cast<float>(this->max_colors)/this->colors;
 
-    int sizes[] = {this->rows, this->cols, this->history};
-    this->model = new cv::Mat(3, sizes, CV_8U, cv::Scalar(0));
+    // Packed samples only hold 4 bits
+    LOG_IF(ERROR, layout == SampleModel::PACKED && this->colors > 16) << "Packed layout needs 16 colors or less, using planar.";
+    const int model_layout = (layout == SampleModel::PACKED && this->colors > 16) ? SampleModel::PLANAR : layout;
+    this->model = new SampleModel(this->rows, this->cols, this->history, model_layout);
 
     this->seed = 0;
-    this->num_generated = 1;
-    this->gen = new std::mt19937(this->seed);
-    this->update = new boost::random::uniform_real_distribution<float>(0, 1);
-    this->history_update = new boost::random::uniform_int_distribution<int>(0, history-1);
-    //this->update_neighbor= new boost::random::uniform_int_distribution<int>(0, 100);
-    this->pick_neighbor = new boost::random::uniform_int_distribution<int>(0, 7);
+    this->frame = 0;
+    this->rng = CounterRNG(this->seed);
+    this->table = RandomTable(this->seed, this->cols, this->history);
+
+    this->band_image = NULL;
+    this->band_mask = NULL;
+    this->band_all_background = false;
+    setThreads(threads);
 }
 
 VANSub::VANSub(const VANSub &other) {
@@ -51,91 +59,99 @@ VANSub::VANSub(const VANSub &other) {
     this->model = other.model;
 
     this->seed = other.seed;
-    this->num_generated = other.num_generated;
-    this->gen = new std::mt19937(this->seed);
-    this->gen->discard(num_generated);
-
-    this->update = new boost::random::uniform_real_distribution<float>(0, 1);
-    this->history_update = new boost::random::uniform_int_distribution<int>(0, history-1);
-    //this->update_neighbor= new boost::random::uniform_int_distribution<int>(0, 100);
-    this->pick_neighbor = new boost::random::uniform_int_distribution<int>(0, 7);
+    this->frame = other.frame;
+    this->rng = other.rng;
+    this->table = other.table;
+
+    this->band_image = NULL;
+    this->band_mask = NULL;
+    this->band_all_background = false;
+    setThreads(other.threads);
 }
 
 VANSub::~VANSub() {
-    delete this->gen;
-    delete this->update;
-    delete this->history_update;
-    //delete this->update_neighbor;
-    delete this->pick_neighbor;
 }
 
-void VANSub::updateModel(const int &r, const int &c, const unsigned char &val, const bool &update_neighbor) {
-    // Add pixel value to background model.
-    this->num_generated += 1;
-    float rng_update = (*(this->update))(*(this->gen));
-    if (rng_update <= 1.0/16.0) {
-        this->num_generated += 1;
-        int pos = (*(this->history_update))(*(this->gen));
-        LOG_IF(ERROR, pos >= this->history) << "RNG Error";
-        this->model->at<unsigned char>(r,c,pos) = val;
-        if (update_neighbor) {
-            this->num_generated += 1;
-            int neighbor = (*(this->pick_neighbor))(*(this->gen));
-            switch(neighbor) {
-                case 0:
-                    if (r > 1 && c > 1) {
-                        updateModel(r-1, c-1, val, false);
-                    }
-                    break;
-                case 1:
-                    if (r > 1) {
-                        updateModel(r-1, c, val, false);
-                    }
-                    break;
-                case 2:
-                    if (r > 1 && c < this->cols - 1) {
-                        updateModel(r-1, c+1, val, false);
-                    }
-                    break;
-                case 3:
-                    if (c > 1) {
-                        updateModel(r, c-1, val, false);
-                    }
-                    break;
-                case 4:
-                    if (c < this->cols - 1) {
-                        updateModel(r, c+1, val, false);
-                    }
-                    break;
-                case 5:
-                    if (r < this->rows - 1 && c > 1) {
-                        updateModel(r+1, c-1, val, false);
-                    }
-                    break;
-                case 6:
-                    if (r < this->rows - 1) {
-                        updateModel(r+1, c, val, false);
-                    }
-                    break;
-                case 7:
-                    if (r < this->rows - 1 && c < this->cols - 1) {
-                        updateModel(r+1, c+1, val, false);
-                    }
-                    break;
-                default:
-                    LOG(ERROR) << "Unknown case selected for neightbor update.";
-                    break;
-            }
-        }
+void VANSub::setThreads(const int threads) {
+    LOG_IF(ERROR, threads <= 0) << "Number of threads has to be positive.";
+    this->threads = threads > 0 ? threads : 1;
+    this->bands = splitRows(this->rows, this->threads);
+    if (this->threads > 1) {
+        this->pool = new ThreadPool(this->threads);
+    } else {
+        this->pool.release();
     }
 }
 
+bool VANSub::updateSample(const int &r, const int &c, const unsigned char &val, const uint32_t &update, const int &slot) {
+    if (update >= update_threshold) {
+        return false;
+    }
+    this->model->set(r, c, slot, val);
+    return true;
+}
+
+void VANSub::updateModel(const int &r, const int &c, const unsigned char &val, const int &i, RowBand &band) {
+    // Add pixel value to background model, i indexes the random table.
+    if (updateSample(r, c, val, this->table.update(i), this->table.slot(i))) {
+        // The neighbour update is batched with the rest of the row, updates
+        // outside of the image end up in the border of the model.
+        band.add(r + this->table.neighborRow(i), c + this->table.neighborCol(i), val, this->table.neighborUpdate(i), this->table.neighborSlot(i));
+    }
+}
+
+// Structuring element of the mask smoothing, built on first use.
+static const cv::Mat& smoothingKernel() {
+    static const cv::Mat kernel = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(5,5), cv::Point(0,0));
+    return kernel;
+}
+
 //Only supports 8-bit images
 void VANSub::operator()(cv::InputArray image, cv::OutputArray fgmask, double learning_rate) {
     this->apply(image, fgmask, learning_rate);
 }
 
 void VANSub::apply(cv::InputArray image, cv::OutputArray fgmask, double learning_rate) {
+    // The mask buffer is kept between frames
+    cv::Mat &mask = this->mask_buffer;
+    mask.create(this->rows, this->cols, CV_8U);
+    mask = cv::Scalar(255);
+    classify(image, &mask);
+    if (!this->active.full()) {
+        this->active.clearExcluded(mask);
+    }
+
+    if (fgmask.needed()) {
+        // Smooth mask (remove noise)
+        //cv::Mat kernel = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(4,4), cv::Point(0,0));
+        // The buffers are kept between frames, OpenCV still allocates its
+        // own scratch memory in here.
+        const cv::Mat &kernel = smoothingKernel();
+        cv::morphologyEx(mask, this->smoothed_mask, cv::MORPH_OPEN, kernel);
+        cv::morphologyEx(this->smoothed_mask, mask, cv::MORPH_CLOSE, kernel);
+
+        mask.copyTo(fgmask);
+
+        // Find Convex Hull
+        cv::findContours(mask, this->contours, this->hierarchy, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+        this->hulls.resize(this->contours.size());
+        for (unsigned int i = 0; i < this->contours.size(); i++) {
+            cv::convexHull(cv::Mat(this->contours[i]), this->hulls[i], false);
+            cv::drawContours(fgmask, this->hulls, i, cv::Scalar(100), CV_FILLED);
+        }
+    }
+}
+
+void VANSub::applyStats(cv::InputArray image, ForegroundStats &stats, double learning_rate) {
+    classify(image, NULL);
+    mergeStats(this->bands, stats);
+}
+
+void VANSub::maintain(cv::InputArray image, double) {
+    classify(image, NULL, true);
+}
+
+void VANSub::classify(cv::InputArray image, cv::Mat *mask, const bool all_background) {
     cv::Mat input_image = image.getMat();
     if (input_image.channels() == 3) {
         cv::cvtColor(input_image, input_image, CV_BGR2GRAY);
@@ -148,59 +164,103 @@ void VANSub::apply(cv::InputArray image, cv::OutputArray fgmask, double learning
         initiateModel(input_image, random_init);
         this->initiated = true;
     }
+    updateActiveSpans(input_image.size());
 
-    cv::Mat mask(this->rows, this->cols, CV_8U, cv::Scalar(255));
-
-    for (int r = 0; r < input_image.rows; r++) {
-        for (int c = 0; c < input_image.cols; c++) {
-            unsigned char input_val = input_image.at<unsigned char>(r,c) * this->color_reduction;
-            int matches = 0;
-            for (int z = 0; z < this->history; z++) {
-                int dist = abs(static_cast<int>(input_val) - model->at<unsigned char>(r,c,z));
-                if (dist <= this->radius) {
-                    matches++;
-                    if (matches >= req_matches) {
-                        break;
-                    }
-                }
+    // Quantized value for every possible intensity
+    for (int i = 0; i < max_colors; i++) {
+        this->reduced[i] = i * this->color_reduction;
+    }
+
+    this->table.fill(this->frame);
+
+    if (this->bands.size() == 1) {
+        applyBand(input_image, mask, this->reduced, all_background, this->bands[0]);
+    } else {
+        this->band_image = &input_image;
+        this->band_mask = mask;
+        this->band_all_background = all_background;
+        // Only capturing this keeps the task small enough for std::function
+        // to store it without allocating.
+        this->pool->run(this->bands.size(), [this](int i) {
+            applyBand(*(this->band_image), this->band_mask, this->reduced, this->band_all_background, this->bands[i]);
+        });
+        this->band_image = NULL;
+    }
+
+    // Neighbour updates that crossed a band boundary, applied in band order
+    // so the result only depends on the seed and the number of threads.
+    for (size_t i = 0; i < this->bands.size(); i++) {
+        std::vector<DeferredUpdate> &deferred = this->bands[i].deferred;
+        for (size_t j = 0; j < deferred.size(); j++) {
+            updateSample(deferred[j].r, deferred[j].c, deferred[j].val, deferred[j].update, deferred[j].slot);
+        }
+        deferred.clear();
+    }
+    this->frame++;
+}
+
+void VANSub::applyBand(const cv::Mat &input_image, cv::Mat *mask, const unsigned char *reduced, const bool all_background, RowBand &band) {
+    const int layout = this->model->getLayout();
+    unsigned char *input_vals = band.byteRow(0, input_image.cols);
+    unsigned char *row_matches = band.byteRow(1, input_image.cols);
+
+    band.reserve(input_image.cols);
+    band.stats.reset(this->active.count(band.row_start, band.row_end));
+    for (int r = band.row_start; r < band.row_end; r++) {
+        const int row_offset = this->table.rowOffset(r);
+        const unsigned char *input_row = input_image.ptr<unsigned char>(r);
+        unsigned char *mask_row = mask != NULL ? mask->ptr<unsigned char>(r) : NULL;
+        const Span *row_begin = this->active.rowBegin(r);
+        const Span *row_end = this->active.rowEnd(r);
+        for (const Span *span = row_begin; span != row_end; span++) {
+            for (int c = span->start; c < span->end; c++) {
+                input_vals[c] = reduced[input_row[c]];
+            }
+        }
+        for (const Span *span = row_begin; span != row_end && !all_background; span++) {
+            if (layout == SampleModel::PLANAR) {
+                countMatchesRow(this->model->row(r) + span->start, this->model->getSampleStep(), this->history, input_vals + span->start, span->end - span->start, this->radius, req_matches, row_matches + span->start);
+            } else if (layout == SampleModel::PACKED) {
+                // Packed rows can only be entered at a block boundary, the
+                // extra pixels in front of the span are ignored.
+                const int start = span->start - span->start % SampleModel::PACKED_BLOCK;
+                countMatchesPackedRow(this->model->row(r) + start / 2, this->model->getSampleStep(), this->history, input_vals + start, span->end - start, this->radius, req_matches, row_matches + start);
             }
-            if (matches >= req_matches) { // Background
-                // Set foreground mask to zero.
-                mask.at<unsigned char>(r,c) = 0;
-                updateModel(r, c, input_val);
-            } else { // Foreground
-                /*
-                this->num_generated += 1;
-                int rng_update = (*(this->absorb_foreground))(*(this->gen));
-                if (rng_update == 0) {
-                    this->num_generated += 1;
-                    int pos = (*(this->history_update))(*(this->gen));
-                    LOG_IF(ERROR, pos >= this->history) << "RNG Error";
-                    model->at<unsigned char>(r,c,pos) = input_val;
+        }
+        for (const Span *span = row_begin; span != row_end; span++) {
+            for (int c = span->start; c < span->end; c++) {
+                unsigned char input_val = input_vals[c];
+                int matches;
+                if (all_background) {
+                    matches = req_matches;
+                } else if (layout != SampleModel::INTERLEAVED) {
+                    matches = row_matches[c];
+                } else {
+                    matches = countMatches(this->model->pixel(r,c), this->history, input_val, this->radius, req_matches);
+                }
+                if (matches >= req_matches) { // Background
+                    // Set foreground mask to zero.
+                    if (mask_row != NULL) {
+                        mask_row[c] = 0;
+                    }
+                    updateModel(r, c, input_val, row_offset + c, band);
+                } else {
+                    band.stats.add(r, c);
                 }
-                */
             }
         }
-    }
 
-    if (fgmask.needed()) {
-        // Smooth mask (remove noise)
-        //cv::Mat kernel = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(4,4), cv::Point(0,0));
-        cv::Mat kernel = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(5,5), cv::Point(0,0));
-        cv::morphologyEx(mask, mask, cv::MORPH_OPEN, kernel);
-        cv::morphologyEx(mask, mask, cv::MORPH_CLOSE, kernel);
-
-        mask.copyTo(fgmask);
-
-        // Find Convex Hull
-        std::vector<std::vector<cv::Point>> contours;
-        std::vector<cv::Vec4i> hierarchy;
-        cv::findContours(mask, contours, hierarchy, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
-        std::vector<std::vector<cv::Point>> hull(contours.size());
-        for (unsigned int i = 0; i < contours.size(); i++) {
-            cv::convexHull(cv::Mat(contours[i]), hull[i], false);
-            cv::drawContours(fgmask, hull, i, cv::Scalar(100), CV_FILLED);
+        // Apply the neighbour updates of the row in one sweep, the ones
+        // landing in another band wait until all bands are done.
+        for (size_t j = 0; j < band.batch.size(); j++) {
+            const DeferredUpdate &update = band.batch[j];
+            if (band.contains(update.r)) {
+                updateSample(update.r, update.c, update.val, update.update, update.slot);
+            } else {
+                band.deferred.push_back(update);
+            }
         }
+        band.batch.clear();
     }
 }
 
@@ -215,35 +275,34 @@ void VANSub::getBackgroundImage(cv::OutputArray background_image) const {
 
     for (int r = 0; r < this->rows; r++) {
         for (int c = 0; c < this->cols; c++) {
-            output.at<unsigned char>(r,c) = this->model->at<unsigned char>(r,c,2) * this->color_expansion;
+            output.at<unsigned char>(r,c) = this->model->get(r,c,2) * this->color_expansion;
         }
     }
 }
 
 void VANSub::initiateModel(cv::Mat &image, cv::Rect &random_init) {
-    boost::random::uniform_int_distribution<int> random_row(0, image.rows-1);
-    boost::random::uniform_int_distribution<int> random_col(0, image.cols-1);
     for (int r = 0; r < image.rows; r++) {
         for (int c = 0; c < image.cols; c++) {
+            const uint32_t pixel = r * image.cols + c;
             if (!random_init.contains(cv::Point(c,r))) {
                 for (int z = 0; z < this->req_matches; z++) {
-                    model->at<unsigned char>(r,c,z) = image.at<unsigned char>(r,c) * this->color_reduction;
+                    this->model->set(r, c, z, image.at<unsigned char>(r,c) * this->color_reduction);
                 }
                 for (int z = this->req_matches; z < this->history; z++) {
                     // TODO Add random pixel value here
-                    this->num_generated += 2;
-                    int row = random_row(*(this->gen));
-                    int col = random_col(*(this->gen));
-                    model->at<unsigned char>(r,c,z) = image.at<unsigned char>(row,col);
+                    const uint64_t bits = this->rng(CounterRNG::INIT_FRAME, pixel, z);
+                    int row = CounterRNG::uniform(static_cast<uint32_t>(bits), image.rows);
+                    int col = CounterRNG::uniform(static_cast<uint32_t>(bits >> 32), image.cols);
+                    this->model->set(r, c, z, image.at<unsigned char>(row,col) * this->color_reduction);
                 }
             } else {
                 // And values randomly from outside the rect
                 for (int z = 0; z < this->history; z++) {
                     // TODO Add random pixel value here
-                    this->num_generated += 2;
-                    int row = random_row(*(this->gen));
-                    int col = random_col(*(this->gen));
-                    model->at<unsigned char>(r,c,z) = image.at<unsigned char>(row,col);
+                    const uint64_t bits = this->rng(CounterRNG::INIT_FRAME, pixel, z);
+                    int row = CounterRNG::uniform(static_cast<uint32_t>(bits), image.rows);
+                    int col = CounterRNG::uniform(static_cast<uint32_t>(bits >> 32), image.cols);
+                    this->model->set(r, c, z, image.at<unsigned char>(row,col) * this->color_reduction);
                 }
             }
         }
@@ -254,7 +313,10 @@ void VANSub::read(const cv::FileNode &node) {
     //Load New Matrices
     cv::Mat temp;
     node["MODEL"] >> temp;
-    this->model = new cv::Mat(temp);
+    int layout;
+    node["LAYOUT"] >> layout;
+    this->model = new SampleModel();
+    const bool samples_read = this->model->fromMat(temp, layout);
 
     //Update Values
     node["ROWS"] >> this->rows;
@@ -266,7 +328,18 @@ void VANSub::read(const cv::FileNode &node) {
     node["COLOR_EXPANSION"] >> this->color_expansion;
     node["INITIATED"] >> this->initiated;
     node["SEED"] >> this->seed;
-    node["NUM_GENERATED"] >> this->num_generated;
+    node["FRAME"] >> this->frame;
+    if (!samples_read) {
+        // Without samples the model starts over with the next frame
+        this->model = new SampleModel(this->rows, this->cols, this->history, layout);
+        this->initiated = false;
+    }
+    this->rng = CounterRNG(this->seed);
+    this->table = RandomTable(this->seed, this->cols, this->history);
+
+    int threads;
+    node["THREADS"] >> threads;
+    setThreads(threads > 0 ? threads : 1);
 }
 
 void VANSub::write(cv::FileStorage &fs) const {
@@ -280,11 +353,62 @@ void VANSub::write(cv::FileStorage &fs) const {
     fs << "COLOR_EXPANSION" << this->color_expansion;
     fs << "INITIATED" << this->initiated;
     fs << "SEED" << this->seed;
-    fs << "NUM_GENERATED" << this->num_generated;
-    fs << "MODEL" << *(this->model);
+    fs << "FRAME" << this->frame;
+    fs << "THREADS" << this->threads;
+    cv::Mat temp;
+    this->model->toMat(temp);
+    fs << "LAYOUT" << this->model->getLayout();
+    fs << "MODEL" << temp;
     fs << "}";
 }
 
+bool VANSub::readBinary(CheckpointReader &reader) {
+    int layout, threads;
+    const bool read = reader.read("ROWS", this->rows)
+        && reader.read("COLS", this->cols)
+        && reader.read("RADIUS", this->radius)
+        && reader.read("COLORS", this->colors)
+        && reader.read("HISTORY", this->history)
+        && reader.read("COLOR_REDUCTION", this->color_reduction)
+        && reader.read("COLOR_EXPANSION", this->color_expansion)
+        && reader.read("INITIATED", this->initiated)
+        && reader.read("SEED", this->seed)
+        && reader.read("FRAME", this->frame)
+        && reader.read("THREADS", threads)
+        && reader.read("LAYOUT", layout);
+    if (!read) {
+        return false;
+    }
+
+    // The samples are stored in the layout of the model, they are copied
+    // in without conversion.
+    cv::Ptr<SampleModel> model = new SampleModel(this->rows, this->cols, this->history, layout);
+    if (!reader.read("MODEL", model->data(), model->dataSize())) {
+        return false;
+    }
+    this->model = model;
+    this->rng = CounterRNG(this->seed);
+    this->table = RandomTable(this->seed, this->cols, this->history);
+    setThreads(threads > 0 ? threads : 1);
+    return true;
+}
+
+void VANSub::writeBinary(CheckpointWriter &writer) const {
+    writer.write("ROWS", this->rows);
+    writer.write("COLS", this->cols);
+    writer.write("RADIUS", this->radius);
+    writer.write("COLORS", this->colors);
+    writer.write("HISTORY", this->history);
+    writer.write("COLOR_REDUCTION", this->color_reduction);
+    writer.write("COLOR_EXPANSION", this->color_expansion);
+    writer.write("INITIATED", this->initiated);
+    writer.write("SEED", this->seed);
+    writer.write("FRAME", this->frame);
+    writer.write("THREADS", this->threads);
+    writer.write("LAYOUT", this->model->getLayout());
+    writer.write("MODEL", this->model->data(), this->model->dataSize());
+}
+
 std::ostream& VANSub::print(std::ostream &out) const {
     out << "{ ";
     out << "rows = " << this->rows << ", ";
@@ -4,31 +4,79 @@
 //C++
 #include <fstream>
 #include <iomanip>
+#include <thread>
 
 //OpenCV
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 
 //My Libs
 #include "video_type.hpp"
 #include "bsub.hpp"
 #include "vansub.hpp"
 #include "hofsub.hpp"
+#include "subtractor_set.hpp"
+#include "bounded_ring.hpp"
+#include "checkpoint.hpp"
 #include "boinc_utils.hpp" //Includes BOINC headers
 
 //Defines
 //#define GUI
+// Count foreground pixels while classifying instead of counting the smoothed
+// masks, the values differ from the mask counts. Only this way a frame does
+// not allocate once the subtractors warmed up, the mask smoothing and convex
+// hulls of VANSub and HOFSub allocate inside of OpenCV on every frame.
+#define STATS_ONLY
+
+// Only run the expensive subtractors on frames where the cheap one (the
+// first, BSub) sees activity, they only maintain their models otherwise.
+//#define CASCADE
+
+// Also export every checkpoint as YAML, for debugging. Checkpoints are
+// always written and read in the binary format.
+//#define YAML_CHECKPOINT
+
+#ifdef GUI
+// The GUI needs the masks
+#undef STATS_ONLY
+#endif
 
 
 /** Staic Vars **/
 static const double ALPHA = 0.1;
+// Foreground fraction of the cheap subtractor that marks a frame as active
+static const double ACTIVITY_THRESHOLD = 0.001;
+// Quiet frames after activity that still get the full classification
+static const int ACTIVITY_HOLD = 30;
+// Decoded frames waiting for the subtractors, bounds the memory of the
+// pipeline
+static const int FRAME_RING_SIZE = 4;
+// Results waiting to be written
+static const int RESULT_RING_SIZE = 64;
 //static const std::string DOWNLOAD_PREFIX = "http://volunteer.cs.und.edu/csg/wildlife_kgoehner/video_interesting_events.php?video_id=";
 
+/** Pipeline Slots */
+struct FrameSlot {
+    cv::Mat frame;
+    // Every subtractor gets the same gray frame, converted once per frame
+    // by the decoder into a buffer that is reused for the whole video.
+    cv::Mat gray;
+    double frame_pos;
+};
+
+// Exponential means of one frame, also the record of the checkpoint log
+struct FrameMeans {
+    double bsub_mean;
+    double vibe_mean;
+    double pbas_mean;
+};
+
 /** Global Vars*/
 std::vector<cv::Ptr<BSub>> subtractors;
 
-std::vector<double> bsub_means;
-std::vector<double> vibe_means;
-std::vector<double> pbas_means;
+std::vector<FrameMeans> means;
+// Means in the log of the last saved checkpoint
+size_t logged_means = 0;
 
 double bsub_exp_mean = 0;
 double vibe_exp_mean = 0;
@@ -45,7 +93,8 @@ void processVideo(const int video_id, cv::VideoCapture &capture);
 void writeFramenumber(cv::Mat &frame, double frame_num);
 int getVideoId(std::string path);
 bool readConfig(std::string filename, std::string *species);
-void writeCheckpoint(const int &frame_pos, const std::vector<cv::Ptr<BSub>> &subtractors) throw(std::runtime_error);
+void writeCheckpoint(CheckpointWriter &outfile, const int &frame_pos, const std::vector<cv::Ptr<BSub>> &subtractors) throw(std::runtime_error);
+void writeYamlCheckpoint(const int &frame_pos, const std::vector<cv::Ptr<BSub>> &subtractors) throw(std::runtime_error);
 bool readCheckpoint(int &frame_pos, std::vector<cv::Ptr<BSub>> &subtractors);
 int skipFrames(cv::VideoCapture &capture, int n);
 
@@ -180,7 +229,7 @@ int main(int argc, char* argv[])
 #endif
         cv::Ptr<BSub> pBSUB = new BSub(); //AccAvg Background subtractor
         cv::Ptr<VANSub> pVIBE = new VANSub(rows, cols, 10, 256, 20); //ViBe Background subtractor
-        cv::Ptr<HOFSub> pPBAS = new HOFSub(rows, cols, 10, 256, 20); //PBAS Background subtractor
+        cv::Ptr<HOFSub> pPBAS = new HOFSub(rows, cols, 10, 256, 20, SampleModel::PLANAR); //PBAS Background subtractor
 
         subtractors.push_back(pBSUB);
         subtractors.push_back(pVIBE);
@@ -207,15 +256,30 @@ int main(int argc, char* argv[])
  * @function processVideo
  */
 void processVideo(const int video_id, cv::VideoCapture &capture) {
-    cv::Mat frame;
-
     double rows = capture.get(CV_CAP_PROP_FRAME_HEIGHT);
     double cols = capture.get(CV_CAP_PROP_FRAME_WIDTH);
     double total_frames = capture.get(CV_CAP_PROP_FRAME_COUNT);
     //double fps = capture.get(CV_CAP_PROP_FPS);
-    double num_pixels = rows * cols;
 
+    // Timestamp and watermark are excluded from every subtractor, the
+    // foreground fractions are relative to the remaining pixels.
     VideoType type(cv::Size(cols, rows));
+    cv::Mat exclusion_mask = type.getMask();
+    for (int i = 0; i < subtractors.size(); i++) {
+        subtractors.at(i)->setExclusionMask(exclusion_mask);
+    }
+    double num_pixels = cv::countNonZero(exclusion_mask);
+
+    // Masks and counts are allocated once for the whole video. Every
+    // subtractor gets its own thread, a frame takes as long as the slowest.
+#ifdef STATS_ONLY
+    SubtractorSet set(subtractors, false, subtractors.size());
+#else
+    SubtractorSet set(subtractors, true, subtractors.size());
+#endif
+    if (total_frames > 0) {
+        means.reserve(total_frames);
+    }
 
     std::string video_id_str = std::to_string(static_cast<long long>(video_id));
     //std::vector<size_t> *event_times = openEventFile(video_id, 10);
@@ -228,21 +292,76 @@ void processVideo(const int video_id, cv::VideoCapture &capture) {
     tsv_file.open(video_id_str + "/data.tsv");
 #endif
 
-    //read input data.
-    while(capture.read(frame)) {
-        double frame_pos = capture.get(CV_CAP_PROP_POS_FRAMES);
+#ifdef CASCADE
+    // Frames since the cheap subtractor last saw activity and the runs of
+    // the expensive subtractors that were skipped.
+    int quiet_frames = 0;
+    long expensive_runs = 0;
+    long skipped_runs = 0;
+#endif
+
+    // Decoding, background subtraction and writing the results run in
+    // their own threads. The decoder blocks once the frame ring is full.
+    BoundedRing<FrameSlot> frames(FRAME_RING_SIZE);
+    std::thread decoder([&]() {
+        //read input data.
+        for (FrameSlot *slot = frames.acquire(); slot != NULL; slot = frames.acquire()) {
+            if (!capture.read(slot->frame)) {
+                break;
+            }
+            slot->frame_pos = capture.get(CV_CAP_PROP_POS_FRAMES);
+            if (slot->frame.channels() == 3) {
+                cv::cvtColor(slot->frame, slot->gray, CV_BGR2GRAY);
+            } else {
+                slot->gray = slot->frame;
+            }
+            frames.publish();
+        }
+        frames.close();
+    });
 
-        // Mask
-        cv::rectangle(frame, type.getTimestampRect(), cv::Scalar(0,0,0), CV_FILLED);
-        cv::rectangle(frame, type.getWatermarkRect(), cv::Scalar(0,0,0), CV_FILLED);
+#ifdef _BOINC_APP_
+    // Checkpoints are written in the background, the frame loop only copies
+    // the state.
+    CheckpointSaver checkpoints(getBoincFilename("checkpoint.bin"));
+    size_t checkpoint_means = logged_means;
+#endif
+
+#ifndef _BOINC_APP_
+    BoundedRing<FrameMeans> results(RESULT_RING_SIZE);
+    std::thread writer([&]() {
+        for (FrameMeans *slot = results.front(); slot != NULL; slot = results.front()) {
+            //Print Stuff
+            tsv_file << video_id << "\t" << slot->bsub_mean << "\t" << slot->vibe_mean << "\t" << slot->pbas_mean << std::endl;
+            results.release();
+        }
+    });
+#endif
 
-        std::vector<cv::Mat*> masks;
-        for (int i = 0; i < subtractors.size(); i++) {
-            masks.push_back(new cv::Mat(frame));
-            subtractors.at(i)->operator()(frame, *(masks.at(i)), 0.1);
+    for (FrameSlot *slot = frames.front(); slot != NULL; slot = frames.front()) {
+        const cv::Mat &gray = slot->gray;
+        const double frame_pos = slot->frame_pos;
+
+#ifdef CASCADE
+        // The cheap subtractor decides whether the others classify.
+        set.apply(0, gray, 0.1);
+        const double activity = set.count(0)/num_pixels;
+        quiet_frames = activity > ACTIVITY_THRESHOLD ? 0 : quiet_frames + 1;
+        expensive_runs += set.size() - 1;
+        if (quiet_frames > ACTIVITY_HOLD) {
+            // Nothing moves, the models only absorb the frame.
+            set.maintainAll(gray, 0.1, 1);
+            skipped_runs += set.size() - 1;
+        } else {
+            set.applyAll(gray, 0.1, 1);
         }
+#else
+        // Returns once every subtractor is done with the frame.
+        set.applyAll(gray, 0.1);
+#endif
 
 #ifdef GUI
+        cv::Mat &frame = slot->frame;
         cv::Mat bsub_model, vibe_model, pbas_model;
         subtractors.at(0)->getBackgroundImage(bsub_model);
         subtractors.at(1)->getBackgroundImage(vibe_model);
@@ -255,68 +374,84 @@ void processVideo(const int video_id, cv::VideoCapture &capture) {
         imshow("BSUB Model", vibe_model);
         imshow("VIBE Model", vibe_model);
         imshow("PBAS Model", pbas_model);
-        imshow("FG Mask BSUB", *(masks.at(0)));
-        imshow("FG Mask VIBE", *(masks.at(1)));
-        imshow("FG Mask PBAS", *(masks.at(2)));
-        //imshow("FG Mask MOG", *(masks.at(2)));
+        imshow("FG Mask BSUB", set.mask(0));
+        imshow("FG Mask VIBE", set.mask(1));
+        imshow("FG Mask PBAS", set.mask(2));
+        //imshow("FG Mask MOG", set.mask(2));
         //get the input from the keyboard
         cv::waitKey(5);
 #endif
 
-        //Count white pixels
-        std::vector<double> pixel_counts;
-        for (int r = 0; r < frame.rows; r++) {
-            for (int c = 0; c < frame.cols; c++) {
-                for (int i = 0; i < masks.size(); i++) {
-                    pixel_counts.push_back(0);
-                    if(masks.at(i)->at<unsigned char>(r, c) > 0) {
-                        pixel_counts.at(i)++;
-                    }
-                }
-            }
-        }
-
-        for (int i = 0; i < masks.size(); i++) {
-            delete masks.at(i);
-        }
-        masks.clear();
-
         // Compile results
-        double next_bsub_val = pixel_counts.at(0)/num_pixels;
-        double next_vibe_val = pixel_counts.at(1)/num_pixels;
-        double next_pbas_val = pixel_counts.at(2)/num_pixels;
+        double next_bsub_val = set.count(0)/num_pixels;
+        double next_vibe_val = set.count(1)/num_pixels;
+        double next_pbas_val = set.count(2)/num_pixels;
 
         bsub_exp_mean = ALPHA * next_bsub_val + (1-ALPHA) * bsub_exp_mean;
         vibe_exp_mean = ALPHA * next_vibe_val + (1-ALPHA) * vibe_exp_mean;
         pbas_exp_mean = ALPHA * next_pbas_val + (1-ALPHA) * pbas_exp_mean;
 
-        bsub_means.push_back(bsub_exp_mean);
-        vibe_means.push_back(vibe_exp_mean);
-        pbas_means.push_back(pbas_exp_mean);
+        const FrameMeans frame_means = {bsub_exp_mean, vibe_exp_mean, pbas_exp_mean};
+        means.push_back(frame_means);
 
 #ifndef _BOINC_APP_
-        //Print Stuff
-        tsv_file << video_id << "\t" << bsub_exp_mean << "\t" << vibe_exp_mean << "\t" << pbas_exp_mean << std::endl;
+        *results.acquire() = frame_means;
+        results.publish();
 #endif
 
 #ifdef _BOINC_APP_
 		// Update percent completion and look for checkpointing request.
 		boinc_fraction_done((double)frame_pos/total_frames);
-		if(boinc_time_to_checkpoint()) {
-			LOG(INFO) << "Checkpointing...";
-			writeCheckpoint(frame_pos, subtractors);
+		// Failed or not, the critical section boinc_time_to_checkpoint()
+		// opened has to end. A failed checkpoint is tried again at the next
+		// checkpoint time.
+		bool saved;
+		if(checkpoints.finished(saved)) {
+			if(saved) {
+				logged_means = checkpoint_means;
+				LOG(INFO) << "Done checkpointing!";
+			} else {
+				LOG(ERROR) << "Checkpointing failed, trying again at the next checkpoint.";
+			}
 			boinc_checkpoint_completed();
-			LOG(INFO) << "Done checkpointing!";
 		}
+		// The next checkpoint starts once the last one is on the disk.
+		if(!checkpoints.busy() && boinc_time_to_checkpoint()) {
+			LOG(INFO) << "Checkpointing...";
+			writeCheckpoint(*checkpoints.snapshot(), frame_pos, subtractors);
+			checkpoint_means = means.size();
+			checkpoints.save();
+		}
+#endif
+        frames.release();
+    }
+    decoder.join();
+#ifndef _BOINC_APP_
+    results.close();
+    writer.join();
 #endif
+#ifdef _BOINC_APP_
+    checkpoints.wait();
+    bool saved;
+    if(checkpoints.finished(saved)) {
+        if(saved) {
+            logged_means = checkpoint_means;
+        }
+        boinc_checkpoint_completed();
     }
+#endif
+
+#ifdef CASCADE
+    LOG(INFO) << "Cascade skipped " << skipped_runs << " of " << expensive_runs << " expensive subtractor runs ("
+        << (expensive_runs > 0 ? 100.0 * skipped_runs / expensive_runs : 0) << "%).";
+#endif
 
 #ifdef _BOINC_APP_
     std::string checkpoint_filename = getBoincFilename("results.tsv");
     std::ofstream results_file(checkpoint_filename);
     results_file << std::scientific << std::setprecision(20);
-    for (unsigned int i = 0; i < vibe_means.size(); i++) {
-        results_file << bsub_means.at(i) << "\t" << vibe_means.at(i) << "\t" << pbas_means.at(i) << std::endl;
+    for (unsigned int i = 0; i < means.size(); i++) {
+        results_file << means[i].bsub_mean << "\t" << means[i].vibe_mean << "\t" << means[i].pbas_mean << std::endl;
     }
     results_file.close();
 #endif
@@ -335,20 +470,48 @@ void writeFramenumber(cv::Mat &frame, double frame_num) {
     cv::putText(frame, frameNumberString.c_str(), cv::Point(15, 15), cv::FONT_HERSHEY_SIMPLEX, 0.5 , cv::Scalar(0,0,0));
 }
 
-void writeCheckpoint(const int &frame_pos, const std::vector<cv::Ptr<BSub>> &subtractors) throw(std::runtime_error) {
+/**
+ * Copies the state into the snapshot, the file is written by the
+ * CheckpointSaver it belongs to. The models are copied whole, of the means
+ * only the ones that are not in the log yet.
+ */
+void writeCheckpoint(CheckpointWriter &outfile, const int &frame_pos, const std::vector<cv::Ptr<BSub>> &subtractors) throw(std::runtime_error) {
+    LOG(INFO) << "WRITE_CURRENT_FRAME: " << frame_pos;
+    outfile.write("CURRENT_FRAME", frame_pos);
+
+    outfile.log(logged_means * sizeof(FrameMeans), means.data() + logged_means, (means.size() - logged_means) * sizeof(FrameMeans));
+
+    outfile.write("BSUB_EXP_MEAN", bsub_exp_mean);
+    outfile.write("VIBE_EXP_MEAN", vibe_exp_mean);
+    outfile.write("PBAS_EXP_MEAN", pbas_exp_mean);
+
+    outfile.beginGroup("BSUB");
+    subtractors.at(0)->writeBinary(outfile);
+    outfile.endGroup();
+    outfile.beginGroup("VANSUB");
+    subtractors.at(1)->writeBinary(outfile);
+    outfile.endGroup();
+    outfile.beginGroup("HOFSUB");
+    subtractors.at(2)->writeBinary(outfile);
+    outfile.endGroup();
+
+#ifdef YAML_CHECKPOINT
+    writeYamlCheckpoint(frame_pos, subtractors);
+#endif
+}
+
+void writeYamlCheckpoint(const int &frame_pos, const std::vector<cv::Ptr<BSub>> &subtractors) throw(std::runtime_error) {
     std::string checkpoint_filename = getBoincFilename("checkpoint.yml");
     //writeEventsToFile(checkpoint_filename, event_types);
     cv::FileStorage outfile(checkpoint_filename, cv::FileStorage::WRITE);
     if (!outfile.isOpened()) {
         throw std::runtime_error("Checkpoint file did not open");
     }
-    LOG(INFO) << "WRITE_CURRENT_FRAME: " << frame_pos;
     //outfile << std::scientific << std::setprecision(20);
     outfile << "CURRENT_FRAME" << frame_pos;
 
-    outfile << "BSUB_MEANS" << bsub_means;
-    outfile << "VIBE_MEANS" << vibe_means;
-    outfile << "PBAS_MEANS" << pbas_means;
+    // One row of bsub, vibe and pbas mean per frame
+    outfile << "MEANS" << cv::Mat(means.size(), 3, CV_64F, means.data());
 
     outfile << "BSUB_EXP_MEAN" << bsub_exp_mean;
     outfile << "VIBE_EXP_MEAN" << vibe_exp_mean;
@@ -363,41 +526,59 @@ void writeCheckpoint(const int &frame_pos, const std::vector<cv::Ptr<BSub>> &sub
 
 bool readCheckpoint(int &frame_pos, std::vector<cv::Ptr<BSub>> &subtractors) {
     LOG(INFO) << "Reading checkpoint...";
-    std::string checkpoint_filename = getBoincFilename("checkpoint.yml");
-    cv::FileStorage infile(checkpoint_filename, cv::FileStorage::READ);
+    std::string checkpoint_filename = getBoincFilename("checkpoint.bin");
+    CheckpointReader infile(checkpoint_filename);
     if (!infile.isOpened()) {
         return false;
     }
-    infile["CURRENT_FRAME"] >> frame_pos;
-    LOG(INFO) << "READ_CURRENT_FRAME: " << frame_pos;
 
-    infile["BSUB_MEANS"] >> bsub_means;
-    infile["VIBE_MEANS"] >> vibe_means;
-    infile["PBAS_MEANS"] >> pbas_means;
+    // Nothing is touched until the whole checkpoint was read.
+    int checkpoint_frame;
+    // The means of every frame up to the checkpoint are in its log
+    std::vector<FrameMeans> checkpoint_means(infile.logSize() / sizeof(FrameMeans));
+    double bsub_checkpoint_mean, vibe_checkpoint_mean, pbas_checkpoint_mean;
+    bool read = infile.read("CURRENT_FRAME", checkpoint_frame)
+        && infile.logSize() % sizeof(FrameMeans) == 0
+        && infile.readLog(checkpoint_means.data(), checkpoint_means.size() * sizeof(FrameMeans))
+        && infile.read("BSUB_EXP_MEAN", bsub_checkpoint_mean)
+        && infile.read("VIBE_EXP_MEAN", vibe_checkpoint_mean)
+        && infile.read("PBAS_EXP_MEAN", pbas_checkpoint_mean);
+
+    cv::Ptr<BSub> b_sub = new BSub();
+    cv::Ptr<BSub> van_sub = new VANSub();
+    cv::Ptr<BSub> hof_sub = new HOFSub();
+    infile.beginGroup("BSUB");
+    read = read && b_sub->readBinary(infile);
+    infile.endGroup();
+    infile.beginGroup("VANSUB");
+    read = read && van_sub->readBinary(infile);
+    infile.endGroup();
+    infile.beginGroup("HOFSUB");
+    read = read && hof_sub->readBinary(infile);
+    infile.endGroup();
+    if (!read) {
+        LOG(ERROR) << "Checkpoint " << checkpoint_filename << " is incomplete.";
+        return false;
+    }
 
-    infile["BSUB_EXP_MEAN"] >> bsub_exp_mean;
+    frame_pos = checkpoint_frame;
+    LOG(INFO) << "READ_CURRENT_FRAME: " << frame_pos;
+    means.swap(checkpoint_means);
+    logged_means = means.size();
+    LOG(INFO) << "READ_MEANS: " << means.size();
+    bsub_exp_mean = bsub_checkpoint_mean;
     LOG(INFO) << "BSUB_EXP_MEAN: " << bsub_exp_mean;
-    infile["VIBE_EXP_MEAN"] >> vibe_exp_mean;
+    vibe_exp_mean = vibe_checkpoint_mean;
     LOG(INFO) << "VIBE_EXP_MEAN: " << vibe_exp_mean;
-    infile["PBAS_EXP_MEAN"] >> pbas_exp_mean;
+    pbas_exp_mean = pbas_checkpoint_mean;
     LOG(INFO) << "PBAS_EXP_MEAN: " << pbas_exp_mean;
 
-    BSub b_sub;
-    infile["BSUB"] >> b_sub;
-    LOG(INFO) << b_sub;
-    subtractors.push_back(new BSub(b_sub));
-
-    VANSub van_sub;
-    infile["VANSUB"] >> van_sub;
-    LOG(INFO) << van_sub;
-    subtractors.push_back(new VANSub(van_sub));
-
-    HOFSub hof_sub;
-    infile["HOFSUB"] >> hof_sub;
-    LOG(INFO) << hof_sub;
-    subtractors.push_back(new HOFSub(hof_sub));
-
-    infile.release();
+    LOG(INFO) << *b_sub;
+    subtractors.push_back(b_sub);
+    LOG(INFO) << *van_sub;
+    subtractors.push_back(van_sub);
+    LOG(INFO) << *hof_sub;
+    subtractors.push_back(hof_sub);
 
     LOG(INFO) << "Done reading checkpoint.";
     return true;
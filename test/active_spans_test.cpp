@@ -0,0 +1,48 @@
+#include "gtest/gtest.h"
+#include "active_spans.hpp"
+
+namespace {
+
+TEST(ActiveSpansTest, FullImage) {
+    ActiveSpans spans(3, 10);
+    ASSERT_TRUE(spans.full());
+    ASSERT_EQ(30, spans.count());
+    ASSERT_EQ(1, spans.rowEnd(1) - spans.rowBegin(1));
+    ASSERT_EQ(0, spans.rowBegin(1)->start);
+    ASSERT_EQ(10, spans.rowBegin(1)->end);
+}
+
+TEST(ActiveSpansTest, SpansFromMask) {
+    cv::Mat mask(3, 10, CV_8U, cv::Scalar(1));
+    mask(cv::Rect(0, 0, 2, 3)) = cv::Scalar(0);
+    mask(cv::Rect(5, 1, 2, 1)) = cv::Scalar(0);
+    mask(cv::Rect(0, 2, 10, 1)) = cv::Scalar(0);
+    ActiveSpans spans(mask);
+
+    ASSERT_FALSE(spans.full());
+    ASSERT_EQ(8 + 6, spans.count());
+    ASSERT_EQ(8, spans.count(0, 1));
+    ASSERT_EQ(0, spans.count(2, 3));
+
+    ASSERT_EQ(1, spans.rowEnd(0) - spans.rowBegin(0));
+    ASSERT_EQ(2, spans.rowEnd(1) - spans.rowBegin(1));
+    ASSERT_EQ(0, spans.rowEnd(2) - spans.rowBegin(2));
+    ASSERT_EQ(2, spans.rowBegin(1)[0].start);
+    ASSERT_EQ(5, spans.rowBegin(1)[0].end);
+    ASSERT_EQ(7, spans.rowBegin(1)[1].start);
+    ASSERT_EQ(10, spans.rowBegin(1)[1].end);
+}
+
+TEST(ActiveSpansTest, ClearExcluded) {
+    cv::Mat mask(4, 8, CV_8U, cv::Scalar(0));
+    mask(cv::Rect(2, 1, 3, 2)) = cv::Scalar(1);
+    ActiveSpans spans(mask);
+
+    cv::Mat image(4, 8, CV_8U, cv::Scalar(255));
+    spans.clearExcluded(image);
+    ASSERT_EQ(6, cv::countNonZero(image));
+    ASSERT_EQ(255, image.at<unsigned char>(1, 2));
+    ASSERT_EQ(0, image.at<unsigned char>(1, 5));
+}
+
+} // namespace
@@ -0,0 +1,84 @@
+#include "gtest/gtest.h"
+#include "bounded_ring.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+TEST(BoundedRingTest, PassesSlotsInOrder) {
+    BoundedRing<int> ring(3);
+    std::thread producer([&ring]() {
+        for (int i = 0; i < 100; i++) {
+            int *slot = ring.acquire();
+            *slot = i;
+            ring.publish();
+        }
+        ring.close();
+    });
+
+    std::vector<int> received;
+    for (int *slot = ring.front(); slot != NULL; slot = ring.front()) {
+        received.push_back(*slot);
+        ring.release();
+    }
+    producer.join();
+
+    ASSERT_EQ(100, received.size());
+    for (int i = 0; i < 100; i++) {
+        ASSERT_EQ(i, received[i]);
+    }
+}
+
+TEST(BoundedRingTest, ProducerBlocksWhenFull) {
+    BoundedRing<int> ring(2);
+    std::atomic<int> published(0);
+    std::thread producer([&]() {
+        for (int i = 0; i < 5; i++) {
+            *ring.acquire() = i;
+            ring.publish();
+            published++;
+        }
+    });
+
+    // Nothing is consumed yet, so the producer stops at the capacity.
+    while (published < 2) {
+        std::this_thread::yield();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT_EQ(2, published);
+
+    for (int i = 0; i < 5; i++) {
+        ASSERT_EQ(i, *ring.front());
+        ring.release();
+    }
+    producer.join();
+    ASSERT_EQ(5, published);
+}
+
+TEST(BoundedRingTest, CloseDrainsPublishedSlots) {
+    BoundedRing<int> ring(4);
+    *ring.acquire() = 7;
+    ring.publish();
+    ring.close();
+
+    ASSERT_TRUE(ring.acquire() == NULL);
+    ASSERT_EQ(7, *ring.front());
+    ring.release();
+    ASSERT_TRUE(ring.front() == NULL);
+}
+
+TEST(BoundedRingTest, SlotsAreReused) {
+    BoundedRing<std::vector<int> > ring(2);
+    for (int i = 0; i < 6; i++) {
+        std::vector<int> *slot = ring.acquire();
+        if (i < 2) {
+            ASSERT_TRUE(slot->empty());
+            slot->resize(16);
+        }
+        ASSERT_EQ(16, slot->size());
+        ring.publish();
+        ring.front();
+        ring.release();
+    }
+}
@@ -0,0 +1,238 @@
+#include "gtest/gtest.h"
+#include "bsub_kernels.hpp"
+
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+std::vector<unsigned char> randomSamples(const int size) {
+    std::vector<unsigned char> samples(size);
+    for (int i = 0; i < size; i++) {
+        samples[i] = rand() % 256;
+    }
+    return samples;
+}
+
+TEST(BSubKernelsTest, CountMatchesEqualsScalar) {
+    srand(47);
+    const int histories[] = {1, 2, 15, 16, 17, 20, 32, 33, 64};
+    const int radii[] = {-1, 0, 10, 20, 128, 255, 300};
+    for (int h = 0; h < 9; h++) {
+        for (int r = 0; r < 7; r++) {
+            for (int trial = 0; trial < 100; trial++) {
+                std::vector<unsigned char> samples = randomSamples(histories[h]);
+                unsigned char val = rand() % 256;
+                for (int max_matches = 1; max_matches <= 4; max_matches++) {
+                    ASSERT_EQ(
+                        countMatchesScalar(&samples[0], histories[h], val, radii[r], max_matches),
+                        countMatches(&samples[0], histories[h], val, radii[r], max_matches));
+                }
+            }
+        }
+    }
+}
+
+TEST(BSubKernelsTest, CountMatchesStopsAtMax) {
+    std::vector<unsigned char> samples(40, 100);
+    ASSERT_EQ(2, countMatches(&samples[0], 40, 100, 0, 2));
+    ASSERT_EQ(0, countMatches(&samples[0], 40, 90, 5, 2));
+}
+
+TEST(BSubKernelsTest, CountMatchesRowEqualsScalar) {
+    srand(47);
+    const int cols_list[] = {1, 15, 16, 17, 31, 32, 33, 100, 704};
+    const int radii[] = {-1, 0, 10, 20, 255};
+    const int history = 20;
+    for (int i = 0; i < 9; i++) {
+        const int cols = cols_list[i];
+        const size_t sample_step = cols + 7;
+        std::vector<unsigned char> samples = randomSamples(sample_step * history);
+        std::vector<unsigned char> vals = randomSamples(cols);
+        for (int r = 0; r < 5; r++) {
+            std::vector<unsigned char> expected(cols), actual(cols);
+            countMatchesRowScalar(&samples[0], sample_step, history, &vals[0], cols, radii[r], 2, &expected[0]);
+            countMatchesRow(&samples[0], sample_step, history, &vals[0], cols, radii[r], 2, &actual[0]);
+            ASSERT_EQ(expected, actual);
+        }
+    }
+}
+
+TEST(BSubKernelsTest, CountMatchesPackedRowEqualsScalar) {
+    srand(47);
+    const int cols_list[] = {1, 31, 32, 33, 63, 64, 65, 100, 704};
+    const int radii[] = {-1, 0, 2, 5, 255};
+    const int history = 20;
+    for (int i = 0; i < 9; i++) {
+        const int cols = cols_list[i];
+        const size_t sample_step = (cols + 31) / 32 * 16 + 32;
+        std::vector<unsigned char> samples = randomSamples(sample_step * history);
+        std::vector<unsigned char> vals = randomSamples(cols);
+        for (int c = 0; c < cols; c++) {
+            vals[c] &= 0x0F;
+        }
+        for (int r = 0; r < 5; r++) {
+            std::vector<unsigned char> expected(cols), actual(cols);
+            countMatchesPackedRowScalar(&samples[0], sample_step, history, &vals[0], cols, radii[r], 2, &expected[0]);
+            countMatchesPackedRow(&samples[0], sample_step, history, &vals[0], cols, radii[r], 2, &actual[0]);
+            ASSERT_EQ(expected, actual);
+        }
+    }
+}
+
+TEST(BSubKernelsTest, UnpackNibbleRow) {
+    srand(47);
+    const int cols = 100;
+    std::vector<unsigned char> packed = randomSamples((cols + 31) / 32 * 16);
+    std::vector<unsigned char> unpacked(cols);
+    unpackNibbleRow(&packed[0], cols, &unpacked[0]);
+    for (int c = 0; c < cols; c++) {
+        ASSERT_EQ(packedNibble(&packed[0], c), unpacked[c]);
+        ASSERT_GT(16, unpacked[c]);
+    }
+    ASSERT_EQ(packed[1] & 0x0F, unpacked[1]);
+    ASSERT_EQ(packed[1] >> 4, unpacked[17]);
+    ASSERT_EQ(packed[16] & 0x0F, unpacked[32]);
+}
+
+TEST(BSubKernelsTest, AccumulateDistancesEqualsScalar) {
+    srand(47);
+    const int cols_list[] = {1, 15, 16, 17, 31, 32, 33, 100, 704};
+    for (int i = 0; i < 9; i++) {
+        const int cols = cols_list[i];
+        std::vector<unsigned char> radius = randomSamples(cols);
+        std::vector<unsigned char> vals = randomSamples(cols);
+        std::vector<unsigned char> expected_matches(cols, 0), actual_matches(cols, 0);
+        std::vector<unsigned char> expected_min(cols, 255), actual_min(cols, 255);
+        for (int z = 0; z < 20; z++) {
+            std::vector<unsigned char> plane = randomSamples(cols);
+            accumulateDistancesScalar(&plane[0], &vals[0], &radius[0], cols, &expected_matches[0], &expected_min[0]);
+            accumulateDistances(&plane[0], &vals[0], &radius[0], cols, &actual_matches[0], &actual_min[0]);
+        }
+        ASSERT_EQ(expected_matches, actual_matches);
+        ASSERT_EQ(expected_min, actual_min);
+    }
+}
+
+TEST(BSubKernelsTest, AccumulatePixelDistancesEqualsScalar) {
+    srand(47);
+    const int num_samples_list[] = {1, 15, 16, 17, 20, 31, 32, 33, 64, 300};
+    for (int i = 0; i < 10; i++) {
+        const int num_samples = num_samples_list[i];
+        for (int j = 0; j < 50; j++) {
+            std::vector<unsigned char> samples = randomSamples(num_samples);
+            const unsigned char val = rand() % 256;
+            const unsigned char radius = rand() % 256;
+            // Start from a previous pixel part of the time
+            unsigned char expected_matches = j % 2 == 0 ? 0 : rand() % 256;
+            unsigned char expected_min = j % 2 == 0 ? 255 : rand() % 256;
+            unsigned char actual_matches = expected_matches;
+            unsigned char actual_min = expected_min;
+            accumulatePixelDistancesScalar(&samples[0], num_samples, val, radius, &expected_matches, &expected_min);
+            accumulatePixelDistances(&samples[0], num_samples, val, radius, &actual_matches, &actual_min);
+            ASSERT_EQ(expected_matches, actual_matches);
+            ASSERT_EQ(expected_min, actual_min);
+        }
+    }
+}
+
+TEST(BSubKernelsTest, AdaptStateRowEqualsScalar) {
+    srand(47);
+    AdaptationParams params;
+    params.learning_rate = 0.3;
+    params.req_matches = 2;
+    params.thresh_scale = 5;
+    params.thresh_min = 18;
+    params.thresh_max = 1000000;
+    params.thresh_inc_rate = 0.05;
+    params.thresh_dec_rate = 0.05;
+    params.update_min = 2;
+    params.update_max = 200;
+    params.update_inc_rate = 1;
+    params.update_dec_rate = 0.05;
+
+    const int cols_list[] = {1, 3, 4, 5, 7, 8, 9, 100, 704};
+    for (int i = 0; i < 9; i++) {
+        const int cols = cols_list[i];
+        std::vector<unsigned char> min_dist = randomSamples(cols);
+        std::vector<unsigned char> matches(cols);
+        std::vector<float> distance(cols), threshold(cols), update(cols);
+        for (int c = 0; c < cols; c++) {
+            // Include zero distances and both threshold clamps.
+            min_dist[c] = c % 7 == 0 ? 0 : min_dist[c];
+            matches[c] = rand() % 5;
+            distance[c] = c % 7 == 0 ? 0 : rand() % 10000 / 100.0f;
+            threshold[c] = c % 11 == 0 ? 1000000 : 18 + rand() % 10000 / 10.0f;
+            update[c] = 2 + rand() % 198;
+        }
+        std::vector<float> expected_distance(distance), actual_distance(distance);
+        std::vector<float> expected_threshold(threshold), actual_threshold(threshold);
+        std::vector<float> expected_update(update), actual_update(update);
+        std::vector<uint32_t> expected_probability(cols), actual_probability(cols);
+        std::vector<unsigned char> expected_background(cols), actual_background(cols);
+        adaptStateRowScalar(&min_dist[0], &matches[0], cols, params, &expected_distance[0], &expected_threshold[0], &expected_update[0], &expected_probability[0], &expected_background[0]);
+        adaptStateRow(&min_dist[0], &matches[0], cols, params, &actual_distance[0], &actual_threshold[0], &actual_update[0], &actual_probability[0], &actual_background[0]);
+        ASSERT_EQ(expected_background, actual_background);
+        for (int c = 0; c < cols; c++) {
+            ASSERT_NEAR(expected_distance[c], actual_distance[c], 1e-4 * expected_distance[c] + 1e-6);
+            ASSERT_NEAR(expected_threshold[c], actual_threshold[c], 1e-4 * expected_threshold[c]);
+            ASSERT_NEAR(expected_update[c], actual_update[c], 1e-4 * expected_update[c]);
+            ASSERT_EQ(CounterRNG::inverseThreshold(actual_update[c]), actual_probability[c]);
+        }
+    }
+}
+
+TEST(BSubKernelsTest, BlendDifferenceRowEqualsScalar) {
+    srand(47);
+    const int cols_list[] = {1, 15, 16, 17, 31, 32, 33, 100, 704};
+    const int weights[] = {0, 1, 26, 128, 255, 256};
+    const int thresholds[] = {0, 150, 254, 255};
+    for (int i = 0; i < 9; i++) {
+        const int cols = cols_list[i];
+        std::vector<unsigned char> input = randomSamples(cols);
+        std::vector<unsigned char> model = randomSamples(cols);
+        for (int w = 0; w < 6; w++) {
+            for (int t = 0; t < 4; t++) {
+                std::vector<unsigned char> expected_model(model), actual_model(model);
+                std::vector<unsigned char> expected_mask(cols), actual_mask(cols);
+                blendDifferenceRowScalar(&input[0], &expected_model[0], cols, thresholds[t], weights[w], &expected_mask[0]);
+                blendDifferenceRow(&input[0], &actual_model[0], cols, thresholds[t], weights[w], &actual_mask[0]);
+                ASSERT_EQ(expected_model, actual_model);
+                ASSERT_EQ(expected_mask, actual_mask);
+
+                // The mask is optional
+                actual_model = model;
+                blendDifferenceRow(&input[0], &actual_model[0], cols, thresholds[t], weights[w], NULL);
+                ASSERT_EQ(expected_model, actual_model);
+            }
+        }
+    }
+}
+
+TEST(BSubKernelsTest, SigmaDeltaRowEqualsScalar) {
+    srand(47);
+    const int cols_list[] = {1, 15, 16, 17, 31, 32, 33, 100, 704};
+    const int amplifications[] = {1, 2, 4};
+    for (int i = 0; i < 9; i++) {
+        const int cols = cols_list[i];
+        std::vector<unsigned char> input = randomSamples(cols);
+        std::vector<unsigned char> background = randomSamples(cols);
+        std::vector<unsigned char> variance = randomSamples(cols);
+        for (int c = 0; c < cols; c += 3) {
+            // Include pixels that match the background
+            input[c] = background[c] + (c % 2);
+        }
+        for (int a = 0; a < 3; a++) {
+            std::vector<unsigned char> expected_background(background), actual_background(background);
+            std::vector<unsigned char> expected_variance(variance), actual_variance(variance);
+            std::vector<unsigned char> expected_mask(cols), actual_mask(cols);
+            sigmaDeltaRowScalar(&input[0], &expected_background[0], &expected_variance[0], cols, amplifications[a], 2, 200, &expected_mask[0]);
+            sigmaDeltaRow(&input[0], &actual_background[0], &actual_variance[0], cols, amplifications[a], 2, 200, &actual_mask[0]);
+            ASSERT_EQ(expected_background, actual_background);
+            ASSERT_EQ(expected_variance, actual_variance);
+            ASSERT_EQ(expected_mask, actual_mask);
+        }
+    }
+}
+
+} // namespace
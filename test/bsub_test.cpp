@@ -3,6 +3,8 @@
 
 #include <glog/logging.h>
 
+#include <cstdlib>
+
 namespace {
 
 class BSubTest : public testing::Test {
@@ -86,6 +88,91 @@ TEST_F(BSubTest, TestLearningRate) {
     delete subtractor;
 }
 
+TEST_F(BSubTest, StatsMatchMask) {
+    BSub mask_subtractor;
+    BSub stats_subtractor;
+    cv::Mat background = cv::Mat::zeros(10, 10, CV_8U);
+    cv::Mat input_image = cv::Mat::zeros(10, 10, CV_8U);
+    input_image(cv::Rect(2, 3, 4, 5)) = cv::Scalar(200);
+
+    cv::Mat mask;
+    ForegroundStats stats;
+    mask_subtractor.apply(background, cv::noArray());
+    stats_subtractor.applyStats(background, stats);
+    ASSERT_EQ(0, stats.count);
+    ASSERT_EQ(0, stats.bounds().area());
+
+    mask_subtractor.apply(input_image, mask);
+    stats_subtractor.applyStats(input_image, stats);
+    ASSERT_EQ(cv::countNonZero(mask), stats.count);
+    ASSERT_EQ(100, stats.total);
+    ASSERT_DOUBLE_EQ(0.2, stats.fraction());
+    ASSERT_EQ(cv::Rect(2, 3, 4, 5), stats.bounds());
+}
+
+TEST_F(BSubTest, ExcludedPixelsAreIgnored) {
+    BSub subtractor;
+    cv::Mat exclusion_mask(10, 10, CV_8U, cv::Scalar(1));
+    exclusion_mask(cv::Rect(0, 0, 10, 2)) = cv::Scalar(0);
+    subtractor.setExclusionMask(exclusion_mask);
+
+    cv::Mat background = cv::Mat::zeros(10, 10, CV_8U);
+    cv::Mat input_image(10, 10, CV_8U, cv::Scalar(200));
+    ForegroundStats stats;
+    subtractor.applyStats(background, stats);
+    subtractor.applyStats(input_image, stats);
+    ASSERT_EQ(80, stats.total);
+    ASSERT_EQ(80, stats.count);
+    ASSERT_DOUBLE_EQ(1.0, stats.fraction());
+    ASSERT_EQ(cv::Rect(0, 2, 10, 8), stats.bounds());
+
+    cv::Mat mask;
+    subtractor.apply(input_image, mask);
+    ASSERT_EQ(0, mask.at<unsigned char>(0, 0));
+}
+
+TEST_F(BSubTest, BlendStaysWithinOneOfFloat) {
+    // Every model value against every difference.
+    cv::Mat background(256, 256, CV_8U);
+    cv::Mat input_image(256, 256, CV_8U);
+    for (int r = 0; r < 256; r++) {
+        for (int c = 0; c < 256; c++) {
+            background.at<unsigned char>(r, c) = r;
+            input_image.at<unsigned char>(r, c) = c;
+        }
+    }
+
+    const double rates[] = {0.01, 0.1, 0.25, 0.3, 0.5, 0.77, 0.9, 1};
+    for (int i = 0; i < 8; i++) {
+        BSub subtractor;
+        subtractor.apply(background, cv::noArray(), 0);
+        subtractor.apply(input_image, cv::noArray(), rates[i]);
+        cv::Mat background_image;
+        subtractor.getBackgroundImage(background_image);
+        for (int r = 0; r < 256; r++) {
+            for (int c = 0; c < 256; c++) {
+                const unsigned char expected = (1 - rates[i]) * r + rates[i] * abs(c - r);
+                ASSERT_NEAR(expected, background_image.at<unsigned char>(r, c), 1);
+            }
+        }
+    }
+}
+
+TEST_F(BSubTest, FrameSizeChangeResetsModel) {
+    BSub subtractor;
+    subtractor.apply(cv::Mat(10, 10, CV_8U, cv::Scalar(50)), cv::noArray(), 0.5);
+    cv::Mat input_image(12, 14, CV_8U, cv::Scalar(200));
+    cv::Mat mask;
+    subtractor.apply(input_image, mask, 0.5);
+    ASSERT_EQ(input_image.size(), mask.size());
+    ASSERT_EQ(0, cv::countNonZero(mask));
+
+    cv::Mat background_image;
+    subtractor.getBackgroundImage(background_image);
+    ASSERT_EQ(input_image.size(), background_image.size());
+    ASSERT_EQ(100, background_image.at<unsigned char>(11, 13));
+}
+
 } // namespace
 
 int main(int argc, char **argv) {
@@ -0,0 +1,290 @@
+#include "gtest/gtest.h"
+#include "checkpoint.hpp"
+#include "mansub.hpp"
+#include "hofsub.hpp"
+
+#include <glog/logging.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+class CheckpointTest : public testing::Test {
+protected:
+    CheckpointTest() {
+        // Log to stderr
+        FLAGS_logtostderr = 1;
+        // Disable INFO logs
+        FLAGS_minloglevel = 1;
+
+        filename = "checkpoint_test.bin";
+        background = cv::Mat(24, 32, CV_8U, cv::Scalar(100));
+        input_image = background.clone();
+        input_image(cv::Rect(4, 4, 8, 8)) = cv::Scalar(200);
+    }
+
+    ~CheckpointTest() {
+        std::remove(filename.c_str());
+        std::remove((filename + ".log").c_str());
+        // Enable ALL logs
+        FLAGS_minloglevel = 0;
+    }
+
+    std::string filename;
+    cv::Mat background;
+    cv::Mat input_image;
+};
+
+TEST_F(CheckpointTest, ValuesRoundTrip) {
+    cv::Mat values(7, 5, CV_32F);
+    cv::RNG rng(47);
+    rng.fill(values, cv::RNG::UNIFORM, cv::Scalar(-10), cv::Scalar(10));
+    const unsigned char raw[5] = {1, 2, 3, 4, 5};
+    {
+        CheckpointWriter writer(filename);
+        ASSERT_TRUE(writer.isOpened());
+        writer.write("INT", -47);
+        writer.write("DOUBLE", 0.125);
+        writer.beginGroup("GROUP");
+        writer.write("VALUES", values);
+        writer.write("RAW", raw, sizeof(raw));
+        writer.endGroup();
+        ASSERT_TRUE(writer.close());
+    }
+
+    CheckpointReader reader(filename);
+    ASSERT_TRUE(reader.isOpened());
+    int int_value;
+    double double_value;
+    ASSERT_TRUE(reader.read("INT", int_value));
+    ASSERT_EQ(-47, int_value);
+    ASSERT_TRUE(reader.read("DOUBLE", double_value));
+    ASSERT_EQ(0.125, double_value);
+    ASSERT_FALSE(reader.read("INT", double_value));
+    ASSERT_FALSE(reader.has("VALUES"));
+
+    reader.beginGroup("GROUP");
+    cv::Mat read_values;
+    ASSERT_TRUE(reader.read("VALUES", read_values));
+    ASSERT_EQ(values.size(), read_values.size());
+    ASSERT_EQ(CV_32F, read_values.type());
+    for (int r = 0; r < values.rows; r++) {
+        for (int c = 0; c < values.cols; c++) {
+            ASSERT_EQ(values.at<float>(r, c), read_values.at<float>(r, c));
+        }
+    }
+    unsigned char read_raw[5];
+    ASSERT_FALSE(reader.read("RAW", read_raw, 4));
+    ASSERT_TRUE(reader.read("RAW", read_raw, sizeof(read_raw)));
+    ASSERT_EQ(0, memcmp(raw, read_raw, sizeof(raw)));
+    reader.endGroup();
+}
+
+TEST_F(CheckpointTest, BlocksAreAligned) {
+    {
+        CheckpointWriter writer(filename);
+        writer.write("A", 1);
+        writer.write("B", 2.0);
+        ASSERT_TRUE(writer.close());
+    }
+
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    CheckpointHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    ASSERT_EQ(0, memcmp(CHECKPOINT_MAGIC, header.magic, sizeof(header.magic)));
+    ASSERT_EQ(CHECKPOINT_VERSION, header.version);
+    ASSERT_EQ(2, header.block_count);
+    file.seekg(header.table_offset);
+    for (uint32_t i = 0; i < header.block_count; i++) {
+        CheckpointBlock block;
+        file.read(reinterpret_cast<char*>(&block), sizeof(block));
+        ASSERT_EQ(0, block.offset % 64);
+    }
+}
+
+TEST_F(CheckpointTest, TruncatedFileIsRejected) {
+    {
+        CheckpointWriter writer(filename);
+        writer.write("VALUES", cv::Mat(16, 16, CV_8U, cv::Scalar(7)));
+        ASSERT_TRUE(writer.close());
+    }
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    std::ofstream out(filename.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(contents.data(), contents.size() - 1);
+    out.close();
+
+    CheckpointReader reader(filename);
+    ASSERT_FALSE(reader.isOpened());
+}
+
+TEST_F(CheckpointTest, MissingFileIsRejected) {
+    CheckpointReader reader("no_such_checkpoint.bin");
+    ASSERT_FALSE(reader.isOpened());
+}
+
+TEST_F(CheckpointTest, CompressedValuesRoundTrip) {
+    // Without zlib the blocks are stored uncompressed.
+    cv::Mat values(64, 64, CV_8U, cv::Scalar(3));
+    values(cv::Rect(8, 8, 4, 4)) = cv::Scalar(9);
+    {
+        CheckpointWriter writer(filename, true);
+        writer.write("VALUES", values);
+        ASSERT_TRUE(writer.close());
+    }
+
+    CheckpointReader reader(filename);
+    cv::Mat read_values;
+    ASSERT_TRUE(reader.read("VALUES", read_values));
+    ASSERT_EQ(values.size(), read_values.size());
+    ASSERT_EQ(0, cv::countNonZero(read_values != values));
+}
+
+TEST_F(CheckpointTest, LogOnlyGrowsByNewRecords) {
+    const int records[5] = {1, 2, 3, 4, 5};
+    {
+        CheckpointWriter writer(filename);
+        writer.log(0, records, 3 * sizeof(int));
+        ASSERT_TRUE(writer.close());
+    }
+    {
+        CheckpointWriter writer(filename);
+        writer.log(3 * sizeof(int), records + 3, 2 * sizeof(int));
+        ASSERT_TRUE(writer.close());
+    }
+
+    int read_records[5];
+    {
+        CheckpointReader reader(filename);
+        ASSERT_EQ(sizeof(records), reader.logSize());
+        ASSERT_FALSE(reader.readLog(read_records, sizeof(records) + 1));
+        ASSERT_TRUE(reader.readLog(read_records, sizeof(records)));
+        ASSERT_EQ(0, memcmp(records, read_records, sizeof(records)));
+    }
+
+    // Records after the offset, like the ones of a failed save, are
+    // replaced.
+    const int replacement = 47;
+    {
+        CheckpointWriter writer(filename);
+        writer.log(2 * sizeof(int), &replacement, sizeof(int));
+        ASSERT_TRUE(writer.close());
+    }
+    CheckpointReader reader(filename);
+    ASSERT_EQ(3 * sizeof(int), reader.logSize());
+    ASSERT_TRUE(reader.readLog(read_records, 3 * sizeof(int)));
+    ASSERT_EQ(1, read_records[0]);
+    ASSERT_EQ(2, read_records[1]);
+    ASSERT_EQ(47, read_records[2]);
+}
+
+TEST_F(CheckpointTest, SaverWritesSnapshotsInTheBackground) {
+    CheckpointSaver saver(filename);
+    bool saved;
+    ASSERT_FALSE(saver.finished(saved));
+    for (int i = 0; i < 10; i++) {
+        CheckpointWriter *snapshot = saver.snapshot();
+        if (snapshot == NULL) {
+            // Both snapshots are still on the way to the disk.
+            continue;
+        }
+        snapshot->write("FRAME", i);
+        snapshot->write("IMAGE", input_image);
+        saver.save();
+    }
+    CheckpointWriter *snapshot = saver.snapshot();
+    while (snapshot == NULL) {
+        ASSERT_TRUE(saver.wait());
+        snapshot = saver.snapshot();
+    }
+    const cv::Mat expected = input_image.clone();
+    snapshot->write("FRAME", 10);
+    snapshot->write("IMAGE", input_image);
+    saver.save();
+    // The state may change once it is copied.
+    input_image.setTo(cv::Scalar(0));
+    ASSERT_TRUE(saver.wait());
+    ASSERT_FALSE(saver.busy());
+    ASSERT_TRUE(saver.finished(saved));
+    ASSERT_TRUE(saved);
+    ASSERT_FALSE(saver.finished(saved));
+
+    CheckpointReader reader(filename);
+    int frame;
+    ASSERT_TRUE(reader.read("FRAME", frame));
+    ASSERT_EQ(10, frame);
+    cv::Mat image;
+    ASSERT_TRUE(reader.read("IMAGE", image));
+    ASSERT_EQ(0, cv::countNonZero(image != expected));
+}
+
+TEST_F(CheckpointTest, SaverReportsFailedSaves) {
+    CheckpointSaver saver("no_such_directory/checkpoint.bin");
+    saver.snapshot()->write("FRAME", 1);
+    saver.save();
+    ASSERT_FALSE(saver.wait());
+    bool saved = true;
+    ASSERT_TRUE(saver.finished(saved));
+    ASSERT_FALSE(saved);
+    ASSERT_FALSE(saver.finished(saved));
+    ASSERT_FALSE(saver.busy());
+
+    // Nothing is retried until the next snapshot is handed over.
+    CheckpointWriter *snapshot = saver.snapshot();
+    ASSERT_TRUE(snapshot != NULL);
+    ASSERT_FALSE(saver.finished(saved));
+    snapshot->write("FRAME", 2);
+    saver.save();
+    ASSERT_FALSE(saver.wait());
+    ASSERT_TRUE(saver.finished(saved));
+    ASSERT_FALSE(saved);
+}
+
+TEST_F(CheckpointTest, SubtractorsResumeWhereTheyStopped) {
+    MANSub man_sub(24, 32);
+    HOFSub hof_sub(24, 32, 20, 256, 20, SampleModel::PLANAR, 1);
+    for (int f = 0; f < 3; f++) {
+        man_sub.apply(f % 2 == 0 ? background : input_image, cv::noArray());
+        hof_sub.apply(f % 2 == 0 ? background : input_image, cv::noArray(), 0.1);
+    }
+    {
+        CheckpointWriter writer(filename);
+        writer.beginGroup("MANSUB");
+        man_sub.writeBinary(writer);
+        writer.endGroup();
+        writer.beginGroup("HOFSUB");
+        hof_sub.writeBinary(writer);
+        writer.endGroup();
+        ASSERT_TRUE(writer.close());
+    }
+
+    MANSub restored_man_sub;
+    HOFSub restored_hof_sub;
+    CheckpointReader reader(filename);
+    reader.beginGroup("MANSUB");
+    ASSERT_TRUE(restored_man_sub.readBinary(reader));
+    reader.endGroup();
+    reader.beginGroup("HOFSUB");
+    ASSERT_TRUE(restored_hof_sub.readBinary(reader));
+    reader.endGroup();
+    // Blocks of one subtractor do not fit another.
+    reader.beginGroup("MANSUB");
+    ASSERT_FALSE(HOFSub().readBinary(reader));
+    reader.endGroup();
+
+    for (int f = 0; f < 3; f++) {
+        const cv::Mat &frame = f % 2 == 0 ? input_image : background;
+        cv::Mat mask, restored_mask;
+        man_sub.apply(frame, mask);
+        restored_man_sub.apply(frame, restored_mask);
+        ASSERT_EQ(0, cv::countNonZero(mask != restored_mask));
+        hof_sub.apply(frame, mask, 0.1);
+        restored_hof_sub.apply(frame, restored_mask, 0.1);
+        ASSERT_EQ(0, cv::countNonZero(mask != restored_mask));
+    }
+}
+
+} // namespace
@@ -0,0 +1,196 @@
+#include "gtest/gtest.h"
+#include "kosub.hpp"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+class KOSubTest : public testing::Test {
+protected:
+    KOSubTest() {
+        // Log to stderr
+        FLAGS_logtostderr = 1;
+        // Disable INFO logs
+        FLAGS_minloglevel = 1;
+
+        cv::RNG rng(47);
+        first = cv::Mat(17, 23, CV_8U);
+        second = cv::Mat(17, 23, CV_8U);
+        rng.fill(first, cv::RNG::UNIFORM, cv::Scalar(0), cv::Scalar(256));
+        rng.fill(second, cv::RNG::UNIFORM, cv::Scalar(0), cv::Scalar(256));
+    }
+
+    ~KOSubTest() {
+        // Enable ALL logs
+        FLAGS_minloglevel = 0;
+    }
+
+    /**
+     * Density of a color around a pixel, straight from the definition.
+     */
+    float density(const cv::Mat &image, const int row, const int col, const int color, const int colors, const int radius) {
+        const float color_reduction = static_cast<float>(colors) / 256;
+        float density = 0;
+        for (int r = std::max(row - radius, 0); r < std::min(row + radius, image.rows); r++) {
+            for (int c = std::max(col - radius, 0); c < std::min(col + radius, image.cols); c++) {
+                density += (color == floor(color_reduction * image.at<unsigned char>(r, c)));
+            }
+        }
+        return density / (radius * radius * 4);
+    }
+
+    cv::Mat first;
+    cv::Mat second;
+};
+
+TEST_F(KOSubTest, DensitiesMatchDefinition) {
+    const int colors = 6;
+    const int radii[] = {1, 3, 12};
+    for (int i = 0; i < 3; i++) {
+        const int radius = radii[i];
+        KOSub subtractor(first.rows, first.cols, colors, radius);
+        ForegroundStats stats;
+        subtractor.applyStats(first, stats, 1);
+        subtractor.applyStats(second, stats, 1);
+
+        // With a learning rate of one the model holds the densities of the
+        // previous frame.
+        int expected_count = 0;
+        cv::Mat expected_background(first.size(), CV_8U);
+        for (int r = 0; r < first.rows; r++) {
+            for (int c = 0; c < first.cols; c++) {
+                unsigned char bg_color = 0;
+                float val = 0;
+                for (int z = 0; z < colors; z++) {
+                    const float new_val = density(second, r, c, z, colors, radius);
+                    val += new_val * density(first, r, c, z, colors, radius);
+                    if (new_val > 0) {
+                        bg_color = z;
+                    }
+                }
+                expected_background.at<unsigned char>(r, c) = bg_color * (256.0f / colors);
+                const float diff = 1-sqrt(val);
+                expected_count += cv::saturate_cast<unsigned char>(255.0 * diff) > 150;
+            }
+        }
+        ASSERT_EQ(expected_count, stats.count);
+
+        cv::Mat background;
+        subtractor.getBackgroundImage(background);
+        for (int r = 0; r < first.rows; r++) {
+            for (int c = 0; c < first.cols; c++) {
+                ASSERT_EQ(expected_background.at<unsigned char>(r, c), background.at<unsigned char>(r, c));
+            }
+        }
+    }
+}
+
+TEST_F(KOSubTest, MemoryLimitPicksRepresentation) {
+    const size_t dense = KOSub::modelSize(48, 64, 256, KOSub::DENSE);
+    const size_t dense_16 = KOSub::modelSize(48, 64, 256, KOSub::DENSE_16);
+    ASSERT_EQ(KOSub::DENSE, KOSub(48, 64, 256, 5).getRepresentation());
+    ASSERT_EQ(KOSub::DENSE, KOSub(48, 64, 256, 5, dense).getRepresentation());
+    ASSERT_EQ(KOSub::DENSE_16, KOSub(48, 64, 256, 5, dense - 1).getRepresentation());
+    ASSERT_EQ(KOSub::DENSE_16, KOSub(48, 64, 256, 5, dense_16).getRepresentation());
+
+    KOSub compact(48, 64, 256, 5, KOSub::modelSize(48, 64, 256, KOSub::TOP_BINS, 8));
+    ASSERT_EQ(KOSub::TOP_BINS, compact.getRepresentation());
+    ASSERT_EQ(8, compact.getBins());
+}
+
+TEST_F(KOSubTest, TopBinsMatchDenseWhenColorsFit) {
+    // Two colors, so every window fits in two bins.
+    const int colors = 4;
+    KOSub dense(first.rows, first.cols, colors, 3, KOSub::modelSize(first.rows, first.cols, colors, KOSub::DENSE_16));
+    KOSub compact(first.rows, first.cols, colors, 3, KOSub::modelSize(first.rows, first.cols, colors, KOSub::TOP_BINS, 2));
+    ASSERT_EQ(KOSub::DENSE_16, dense.getRepresentation());
+    ASSERT_EQ(KOSub::TOP_BINS, compact.getRepresentation());
+
+    for (int i = 0; i < 4; i++) {
+        cv::Mat frame = cv::Mat::zeros(first.size(), CV_8U);
+        frame(cv::Rect(0, 0, 8 + 3 * i, first.rows)) = cv::Scalar(255);
+        ForegroundStats dense_stats, compact_stats;
+        dense.applyStats(frame, dense_stats, 0.5);
+        compact.applyStats(frame, compact_stats, 0.5);
+        ASSERT_EQ(dense_stats.count, compact_stats.count);
+
+        cv::Mat dense_background, compact_background;
+        dense.getBackgroundImage(dense_background);
+        compact.getBackgroundImage(compact_background);
+        for (int r = 0; r < first.rows; r++) {
+            for (int c = 0; c < first.cols; c++) {
+                ASSERT_EQ(dense_background.at<unsigned char>(r, c), compact_background.at<unsigned char>(r, c));
+            }
+        }
+    }
+}
+
+TEST_F(KOSubTest, TopBinsTakeBackEvictedColors) {
+    // One bin per pixel, the striped frame puts two colors in every window.
+    const int colors = 4;
+    KOSub dense(first.rows, first.cols, colors, 1, KOSub::modelSize(first.rows, first.cols, colors, KOSub::DENSE_16));
+    KOSub compact(first.rows, first.cols, colors, 1, KOSub::modelSize(first.rows, first.cols, colors, KOSub::TOP_BINS, 1));
+    ASSERT_EQ(KOSub::TOP_BINS, compact.getRepresentation());
+    ASSERT_EQ(1, compact.getBins());
+
+    cv::Mat uniform(first.size(), CV_8U, cv::Scalar(64));
+    cv::Mat striped(first.size(), CV_8U);
+    for (int r = 0; r < striped.rows; r++) {
+        for (int c = 0; c < striped.cols; c++) {
+            striped.at<unsigned char>(r, c) = c % 2 == 0 ? 128 : 192;
+        }
+    }
+
+    // The striped frame evicts color 1 from every pixel, the last frame
+    // has to bring it back everywhere.
+    const cv::Mat frames[] = {uniform, striped, uniform};
+    for (int i = 0; i < 3; i++) {
+        ForegroundStats dense_stats, compact_stats;
+        dense.applyStats(frames[i], dense_stats, 1);
+        compact.applyStats(frames[i], compact_stats, 1);
+    }
+
+    cv::Mat dense_background, compact_background;
+    dense.getBackgroundImage(dense_background);
+    compact.getBackgroundImage(compact_background);
+    for (int r = 0; r < first.rows; r++) {
+        for (int c = 0; c < first.cols; c++) {
+            ASSERT_EQ(64, dense_background.at<unsigned char>(r, c));
+            ASSERT_EQ(64, compact_background.at<unsigned char>(r, c));
+        }
+    }
+}
+
+TEST_F(KOSubTest, ColorsThatDisappearLeaveTheBackground) {
+    const int colors = 4;
+    KOSub dense(first.rows, first.cols, colors, 1, KOSub::modelSize(first.rows, first.cols, colors, KOSub::DENSE_16));
+    KOSub compact(first.rows, first.cols, colors, 1, KOSub::modelSize(first.rows, first.cols, colors, KOSub::TOP_BINS, 2));
+    ASSERT_EQ(KOSub::DENSE_16, dense.getRepresentation());
+    ASSERT_EQ(KOSub::TOP_BINS, compact.getRepresentation());
+
+    // Color 3 is seen once, its weights have to decay all the way to zero.
+    const cv::Mat gone(first.size(), CV_8U, cv::Scalar(192));
+    const cv::Mat uniform(first.size(), CV_8U, cv::Scalar(64));
+    ForegroundStats stats;
+    dense.applyStats(gone, stats, 1);
+    compact.applyStats(gone, stats, 1);
+    for (int i = 0; i < 200; i++) {
+        dense.applyStats(uniform, stats, 0.1);
+        compact.applyStats(uniform, stats, 0.1);
+    }
+
+    cv::Mat dense_background, compact_background;
+    dense.getBackgroundImage(dense_background);
+    compact.getBackgroundImage(compact_background);
+    for (int r = 0; r < first.rows; r++) {
+        for (int c = 0; c < first.cols; c++) {
+            ASSERT_EQ(64, dense_background.at<unsigned char>(r, c));
+            ASSERT_EQ(64, compact_background.at<unsigned char>(r, c));
+        }
+    }
+}
+
+} // namespace
@@ -0,0 +1,80 @@
+#include "gtest/gtest.h"
+#include "mansub.hpp"
+
+#include <glog/logging.h>
+
+namespace {
+
+class MANSubTest : public testing::Test {
+protected:
+    MANSubTest() {
+        // Log to stderr
+        FLAGS_logtostderr = 1;
+        // Disable INFO logs
+        FLAGS_minloglevel = 1;
+
+        background = cv::Mat(20, 20, CV_8U, cv::Scalar(100));
+        input_image = background.clone();
+        input_image(cv::Rect(4, 4, 8, 8)) = cv::Scalar(200);
+    }
+
+    ~MANSubTest() {
+        // Enable ALL logs
+        FLAGS_minloglevel = 0;
+    }
+
+    cv::Mat background;
+    cv::Mat input_image;
+};
+
+TEST_F(MANSubTest, StaticSceneIsBackground) {
+    MANSub subtractor(20, 20);
+    cv::Mat mask;
+    for (int i = 0; i < 3; i++) {
+        subtractor.apply(background, mask);
+        ASSERT_EQ(0, cv::countNonZero(mask));
+    }
+}
+
+TEST_F(MANSubTest, BackgroundMovesOneLevelPerFrame) {
+    MANSub subtractor(20, 20);
+    subtractor.apply(background, cv::noArray());
+    for (int i = 1; i <= 3; i++) {
+        subtractor.apply(input_image, cv::noArray());
+        cv::Mat model;
+        subtractor.getBackgroundImage(model);
+        ASSERT_EQ(100 + i, model.at<unsigned char>(5, 5));
+        ASSERT_EQ(100, model.at<unsigned char>(0, 0));
+    }
+}
+
+TEST_F(MANSubTest, StatsMatchMask) {
+    MANSub mask_subtractor(20, 20);
+    MANSub stats_subtractor(20, 20);
+    ForegroundStats stats;
+    mask_subtractor.apply(background, cv::noArray());
+    stats_subtractor.applyStats(background, stats);
+
+    cv::Mat mask;
+    mask_subtractor.apply(input_image, mask);
+    stats_subtractor.applyStats(input_image, stats);
+    ASSERT_EQ(64, cv::countNonZero(mask));
+    ASSERT_EQ(64, stats.count);
+    ASSERT_EQ(400, stats.total);
+    ASSERT_EQ(cv::Rect(4, 4, 8, 8), stats.bounds());
+}
+
+TEST_F(MANSubTest, ExcludedPixelsAreIgnored) {
+    MANSub subtractor(20, 20);
+    cv::Mat exclusion_mask(20, 20, CV_8U, cv::Scalar(1));
+    exclusion_mask(cv::Rect(0, 0, 20, 8)) = cv::Scalar(0);
+    subtractor.setExclusionMask(exclusion_mask);
+
+    cv::Mat mask;
+    subtractor.apply(background, mask);
+    subtractor.apply(input_image, mask);
+    ASSERT_EQ(32, cv::countNonZero(mask));
+    ASSERT_EQ(0, mask.at<unsigned char>(5, 5));
+}
+
+} // namespace
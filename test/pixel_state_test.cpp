@@ -0,0 +1,159 @@
+#include "gtest/gtest.h"
+#include "pixel_state.hpp"
+#include "bsub_kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+TEST(PixelStateTest, FloatRoundTrip) {
+    PixelState state(4, 70, PixelState::FLOAT);
+    state.fill(PixelState::UPDATE, 200);
+    state.set(PixelState::THRESHOLD, 1, 2, 18.25f);
+    state.set(PixelState::UPDATE, 3, 69, 2.5f);
+    ASSERT_EQ(18.25f, state.get(PixelState::THRESHOLD, 1, 2));
+    ASSERT_EQ(2.5f, state.get(PixelState::UPDATE, 3, 69));
+    ASSERT_EQ(200, state.get(PixelState::UPDATE, -1, -1));
+    ASSERT_EQ(200, state.get(PixelState::UPDATE, 4, 70));
+    ASSERT_EQ(0, state.get(PixelState::DISTANCE, 3, 69));
+}
+
+TEST(PixelStateTest, FixedPointRoundTrip) {
+    PixelState state(4, 70, PixelState::FIXED);
+    for (int r = 0; r < 4; r++) {
+        for (int c = 0; c < 70; c++) {
+            const float value = (r * 70 + c) * 0.731f;
+            state.set(PixelState::DISTANCE, r, c, value);
+            state.set(PixelState::THRESHOLD, r, c, value * 8);
+            state.set(PixelState::UPDATE, r, c, value);
+        }
+    }
+    for (int r = 0; r < 4; r++) {
+        for (int c = 0; c < 70; c++) {
+            const float value = (r * 70 + c) * 0.731f;
+            ASSERT_NEAR(value, state.get(PixelState::DISTANCE, r, c), 0.5f / 256);
+            ASSERT_NEAR(value * 8, state.get(PixelState::THRESHOLD, r, c), 0.5f / 32);
+            // Update values are kept as thresholds, which end at one
+            ASSERT_NEAR(std::max(value, 1.0f), state.get(PixelState::UPDATE, r, c), 1e-4f);
+        }
+    }
+}
+
+TEST(PixelStateTest, FixedPointSaturates) {
+    PixelState state(1, 1, PixelState::FIXED);
+    state.set(PixelState::THRESHOLD, 0, 0, 1000000);
+    ASSERT_NEAR(2048, state.get(PixelState::THRESHOLD, 0, 0), 0.05);
+    ASSERT_NEAR(state.maxValue(PixelState::THRESHOLD), state.get(PixelState::THRESHOLD, 0, 0), 0.05);
+    state.set(PixelState::DISTANCE, 0, 0, -1);
+    ASSERT_EQ(0, state.get(PixelState::DISTANCE, 0, 0));
+}
+
+TEST(PixelStateTest, FixedPointKeepsSmallUpdateSteps) {
+    PixelState state(1, 1, PixelState::FIXED);
+    state.set(PixelState::UPDATE, 0, 0, 200);
+    for (int i = 0; i < 100; i++) {
+        state.set(PixelState::UPDATE, 0, 0, state.get(PixelState::UPDATE, 0, 0) - 0.05f / 255);
+    }
+    ASSERT_NEAR(200 - 100 * 0.05f / 255, state.get(PixelState::UPDATE, 0, 0), 1e-3f);
+}
+
+TEST(PixelStateTest, FixedPointFollowsFloatAdaptation) {
+    // The HOFSub adaptation with far distances, where every background
+    // frame lowers the update value by less than 1/1000.
+    const int cols = 64;
+    AdaptationParams params = {0.1f, 2, 5, 18, 1000000, 0.05f, 0.05f, 2, 200, 1, 0.05f};
+    PixelState float_state(1, cols, PixelState::FLOAT);
+    PixelState fixed_state(1, cols, PixelState::FIXED);
+    params.thresh_max = std::min(params.thresh_max, fixed_state.maxValue(PixelState::THRESHOLD));
+    PixelState *states[] = {&float_state, &fixed_state};
+    for (int i = 0; i < 2; i++) {
+        states[i]->fill(PixelState::THRESHOLD, 20);
+        states[i]->fill(PixelState::UPDATE, 100);
+    }
+
+    CounterRNG rng(47);
+    std::vector<unsigned char> min_dist(cols), matches(cols), background(cols);
+    std::vector<float> distance(cols), threshold(cols), update(cols);
+    std::vector<uint32_t> update_threshold(cols);
+    const int frames = 4000;
+    for (int f = 0; f < frames; f++) {
+        for (int c = 0; c < cols; c++) {
+            const uint64_t bits = rng(f, c, 0);
+            min_dist[c] = 60 + bits % 60;
+            matches[c] = (bits >> 8) % 32 == 0 ? 0 : params.req_matches;
+        }
+        for (int i = 0; i < 2; i++) {
+            for (int c = 0; c < cols; c++) {
+                distance[c] = states[i]->get(PixelState::DISTANCE, 0, c);
+                threshold[c] = states[i]->get(PixelState::THRESHOLD, 0, c);
+                update[c] = states[i]->get(PixelState::UPDATE, 0, c);
+            }
+            adaptStateRowScalar(&min_dist[0], &matches[0], cols, params, &distance[0], &threshold[0], &update[0], &update_threshold[0], &background[0]);
+            for (int c = 0; c < cols; c++) {
+                states[i]->set(PixelState::DISTANCE, 0, c, distance[c]);
+                states[i]->set(PixelState::THRESHOLD, 0, c, threshold[c]);
+                states[i]->set(PixelState::UPDATE, 0, c, update[c]);
+            }
+        }
+    }
+
+    for (int c = 0; c < cols; c++) {
+        const float float_update = float_state.get(PixelState::UPDATE, 0, c);
+        ASSERT_GT(100 - 0.5f, float_update);
+        ASSERT_NEAR(float_update, fixed_state.get(PixelState::UPDATE, 0, c), 0.01f);
+        ASSERT_NEAR(float_state.get(PixelState::DISTANCE, 0, c), fixed_state.get(PixelState::DISTANCE, 0, c), 0.05f);
+        const float float_threshold = float_state.get(PixelState::THRESHOLD, 0, c);
+        // Where the rounding flipped a comparison the thresholds are one
+        // increase and decrease apart.
+        const float step = (1 + params.thresh_inc_rate) / (1 - params.thresh_dec_rate) - 1;
+        ASSERT_NEAR(float_threshold, fixed_state.get(PixelState::THRESHOLD, 0, c), step * float_threshold * 1.01f);
+    }
+}
+
+TEST(PixelStateTest, MatRoundTrip) {
+    cv::Mat input(3, 5, CV_32F, cv::Scalar(7.5));
+    PixelState state(3, 5, PixelState::FIXED);
+    ASSERT_TRUE(state.fromMat(PixelState::UPDATE, input));
+    cv::Mat output;
+    state.toMat(PixelState::UPDATE, output);
+    ASSERT_EQ(input.size(), output.size());
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 5; c++) {
+            ASSERT_EQ(7.5f, output.at<float>(r, c));
+        }
+    }
+}
+
+TEST(PixelStateTest, MatMismatchLeavesFieldAlone) {
+    PixelState state(3, 5, PixelState::FIXED);
+    state.fill(PixelState::THRESHOLD, 20);
+    ASSERT_FALSE(state.fromMat(PixelState::THRESHOLD, cv::Mat()));
+    ASSERT_FALSE(state.fromMat(PixelState::THRESHOLD, cv::Mat(3, 4, CV_32F, cv::Scalar(7.5))));
+    ASSERT_FALSE(state.fromMat(PixelState::THRESHOLD, cv::Mat(3, 5, CV_8U, cv::Scalar(7))));
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 5; c++) {
+            ASSERT_EQ(20, state.get(PixelState::THRESHOLD, r, c));
+        }
+    }
+}
+
+TEST(PixelStateTest, UpdateThresholdFollowsUpdate) {
+    PixelState state(2, 3, PixelState::FLOAT);
+    state.fill(PixelState::UPDATE, 200);
+    state.set(PixelState::UPDATE, 1, 2, 4);
+    ASSERT_EQ(1u << 30, state.updateThreshold(1, 2));
+    ASSERT_EQ(CounterRNG::inverseThreshold(200), state.updateThreshold(-1, -1));
+    ASSERT_EQ(CounterRNG::inverseThreshold(200), state.updateThreshold(2, 3));
+}
+
+TEST(PixelStateTest, InverseThreshold) {
+    ASSERT_EQ(1u << 31, CounterRNG::inverseThreshold(2));
+    ASSERT_EQ(1u << 28, CounterRNG::inverseThreshold(16));
+    ASSERT_LT(4294967000u, CounterRNG::inverseThreshold(1));
+    ASSERT_LT(4294967000u, CounterRNG::inverseThreshold(0));
+    ASSERT_EQ(0u, CounterRNG::inverseThreshold(-1));
+}
+
+} // namespace
@@ -0,0 +1,56 @@
+#include "gtest/gtest.h"
+#include "scalesub.hpp"
+
+#include <glog/logging.h>
+
+namespace {
+
+class ScaleSubTest : public testing::Test {
+protected:
+    ScaleSubTest() {
+        // Log to stderr
+        FLAGS_logtostderr = 1;
+        // Disable INFO logs
+        FLAGS_minloglevel = 1;
+
+        background = cv::Mat::zeros(20, 20, CV_8U);
+        input_image = cv::Mat::zeros(20, 20, CV_8U);
+        input_image(cv::Rect(4, 4, 8, 8)) = cv::Scalar(200);
+    }
+
+    ~ScaleSubTest() {
+        // Enable ALL logs
+        FLAGS_minloglevel = 0;
+    }
+
+    cv::Mat background;
+    cv::Mat input_image;
+};
+
+TEST_F(ScaleSubTest, ScaledSize) {
+    ASSERT_EQ(cv::Size(352, 240), ScaleSub::scaledSize(cv::Size(704, 480), 2));
+    ASSERT_EQ(cv::Size(176, 120), ScaleSub::scaledSize(cv::Size(704, 480), 4));
+}
+
+TEST_F(ScaleSubTest, MaskHasInputSize) {
+    ScaleSub subtractor(new BSub(), 2);
+    cv::Mat mask;
+    subtractor.apply(background, cv::noArray());
+    subtractor.apply(input_image, mask);
+    ASSERT_EQ(input_image.size(), mask.size());
+    ASSERT_EQ(64, cv::countNonZero(mask));
+    ASSERT_EQ(255, mask.at<unsigned char>(4, 4));
+    ASSERT_EQ(0, mask.at<unsigned char>(3, 3));
+}
+
+TEST_F(ScaleSubTest, StatsInInputPixels) {
+    ScaleSub subtractor(new BSub(), 2);
+    ForegroundStats stats;
+    subtractor.applyStats(background, stats);
+    subtractor.applyStats(input_image, stats);
+    ASSERT_EQ(64, stats.count);
+    ASSERT_EQ(400, stats.total);
+    ASSERT_EQ(cv::Rect(4, 4, 8, 8), stats.bounds());
+}
+
+} // namespace
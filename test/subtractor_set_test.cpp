@@ -0,0 +1,244 @@
+#include "gtest/gtest.h"
+#include "subtractor_set.hpp"
+#include "mansub.hpp"
+#include "vansub.hpp"
+#include "hofsub.hpp"
+
+#include <glog/logging.h>
+
+#include <atomic>
+#include <cstddef>
+
+#ifdef __GLIBC__
+// Every heap allocation of the test binary, OpenCV's included, goes through
+// these. Allocations are only counted while counting is set.
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void *ptr, size_t size);
+
+static std::atomic<bool> counting(false);
+static std::atomic<long> allocations(0);
+
+extern "C" void* malloc(size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void *ptr, size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+namespace {
+
+class SubtractorSetTest : public testing::Test {
+protected:
+    SubtractorSetTest() {
+        // Log to stderr
+        FLAGS_logtostderr = 1;
+        // Disable INFO logs
+        FLAGS_minloglevel = 1;
+
+        background = cv::Mat(24, 32, CV_8U, cv::Scalar(100));
+        input_image = background.clone();
+        input_image(cv::Rect(4, 4, 8, 8)) = cv::Scalar(200);
+    }
+
+    ~SubtractorSetTest() {
+        // Enable ALL logs
+        FLAGS_minloglevel = 0;
+    }
+
+#ifdef __GLIBC__
+    /**
+     * Heap allocations of running every subtractor of the set on the given
+     * number of frames.
+     */
+    long countAllocations(SubtractorSet &set, const int frames) {
+        allocations = 0;
+        counting = true;
+        for (int f = 0; f < frames; f++) {
+            set.applyAll(f % 2 == 0 ? background : input_image, 0.1);
+        }
+        counting = false;
+        return allocations;
+    }
+
+    /**
+     * Heap allocations of classifying the given number of frames without
+     * asking for the mask. apply() is not virtual, operator() is.
+     */
+    long countAllocations(BSub &subtractor, const int frames) {
+        allocations = 0;
+        counting = true;
+        for (int f = 0; f < frames; f++) {
+            subtractor(f % 2 == 0 ? background : input_image, cv::noArray(), 0.1);
+        }
+        counting = false;
+        return allocations;
+    }
+
+    /**
+     * Every subtractor kind, the sample based ones in every layout and with
+     * threads of their own.
+     */
+    std::vector<cv::Ptr<BSub> > allSubtractors() {
+        std::vector<cv::Ptr<BSub> > subtractors;
+        subtractors.push_back(new BSub());
+        subtractors.push_back(new MANSub(24, 32));
+        subtractors.push_back(new VANSub(24, 32));
+        subtractors.push_back(new VANSub(24, 32, 10, 256, 20, SampleModel::PLANAR, 2));
+        subtractors.push_back(new HOFSub(24, 32));
+        subtractors.push_back(new HOFSub(24, 32, 20, 256, 20, SampleModel::PLANAR, 2));
+        return subtractors;
+    }
+#endif
+
+    cv::Mat background;
+    cv::Mat input_image;
+};
+
+TEST_F(SubtractorSetTest, CountsMatchMasks) {
+    std::vector<cv::Ptr<BSub> > subtractors;
+    subtractors.push_back(new BSub());
+    subtractors.push_back(new MANSub(24, 32));
+    SubtractorSet set(subtractors);
+
+    for (int f = 0; f < 3; f++) {
+        for (size_t i = 0; i < set.size(); i++) {
+            set.apply(i, f == 0 ? background : input_image, 0.1);
+            ASSERT_EQ(cv::countNonZero(set.mask(i)), set.count(i));
+        }
+    }
+    ASSERT_EQ(64, set.count(1));
+}
+
+TEST_F(SubtractorSetTest, CountsWithoutMasks) {
+    std::vector<cv::Ptr<BSub> > subtractors;
+    subtractors.push_back(new MANSub(24, 32));
+    SubtractorSet set(subtractors, false);
+    ASSERT_FALSE(set.keepsMasks());
+
+    set.apply(0, background, 0.1);
+    ASSERT_EQ(0, set.count(0));
+    set.apply(0, input_image, 0.1);
+    ASSERT_EQ(64, set.count(0));
+}
+
+TEST_F(SubtractorSetTest, MaintainClearsMask) {
+    std::vector<cv::Ptr<BSub> > subtractors;
+    subtractors.push_back(new MANSub(24, 32));
+    SubtractorSet set(subtractors);
+
+    set.apply(0, background, 0.1);
+    set.apply(0, input_image, 0.1);
+    ASSERT_EQ(64, set.count(0));
+    set.maintain(0, input_image, 0.1);
+    ASSERT_EQ(0, set.count(0));
+    ASSERT_EQ(0, cv::countNonZero(set.mask(0)));
+    ASSERT_EQ(input_image.size(), set.mask(0).size());
+}
+
+TEST_F(SubtractorSetTest, ConcurrentMatchesSequential) {
+    std::vector<cv::Ptr<BSub> > sequential_subtractors;
+    std::vector<cv::Ptr<BSub> > concurrent_subtractors;
+    for (int i = 0; i < 2; i++) {
+        std::vector<cv::Ptr<BSub> > &subtractors = i == 0 ? sequential_subtractors : concurrent_subtractors;
+        subtractors.push_back(new BSub());
+        subtractors.push_back(new MANSub(24, 32));
+        subtractors.push_back(new HOFSub(24, 32));
+    }
+    SubtractorSet sequential(sequential_subtractors, true, 1);
+    SubtractorSet concurrent(concurrent_subtractors, true, 3);
+
+    for (int f = 0; f < 6; f++) {
+        const cv::Mat &frame = f % 3 == 0 ? background : input_image;
+        if (f == 4) {
+            // Only the first subtractor classifies, like in the cascade.
+            sequential.apply(0, frame, 0.1);
+            for (size_t i = 1; i < sequential.size(); i++) {
+                sequential.maintain(i, frame, 0.1);
+            }
+            concurrent.apply(0, frame, 0.1);
+            concurrent.maintainAll(frame, 0.1, 1);
+        } else {
+            for (size_t i = 0; i < sequential.size(); i++) {
+                sequential.apply(i, frame, 0.1);
+            }
+            concurrent.applyAll(frame, 0.1);
+        }
+        for (size_t i = 0; i < sequential.size(); i++) {
+            ASSERT_EQ(sequential.count(i), concurrent.count(i));
+            for (int r = 0; r < frame.rows; r++) {
+                for (int c = 0; c < frame.cols; c++) {
+                    ASSERT_EQ(sequential.mask(i).at<unsigned char>(r, c), concurrent.mask(i).at<unsigned char>(r, c));
+                }
+            }
+        }
+    }
+}
+
+#ifdef __GLIBC__
+TEST_F(SubtractorSetTest, SteadyStateFramesDoNotAllocate) {
+    std::vector<cv::Ptr<BSub> > mask_subtractors;
+    mask_subtractors.push_back(new BSub());
+    mask_subtractors.push_back(new MANSub(24, 32));
+    SubtractorSet masks(mask_subtractors);
+    SubtractorSet threaded_masks(mask_subtractors, true, 2);
+
+    SubtractorSet stats(allSubtractors(), false);
+    SubtractorSet threaded_stats(allSubtractors(), false, 3);
+
+    // Warm up, the first frames create the models and buffers.
+    ASSERT_LT(0, countAllocations(masks, 4));
+    countAllocations(threaded_masks, 4);
+    countAllocations(stats, 4);
+    countAllocations(threaded_stats, 4);
+
+    ASSERT_EQ(0, countAllocations(masks, 10));
+    ASSERT_EQ(0, countAllocations(threaded_masks, 10));
+    ASSERT_EQ(0, countAllocations(stats, 10));
+    ASSERT_EQ(0, countAllocations(threaded_stats, 10));
+}
+
+TEST_F(SubtractorSetTest, SampleSubtractorsOnlyAllocateInMaskPostProcessing) {
+    // The smoothing and convex hulls of the VANSub and HOFSub masks allocate
+    // inside of OpenCV. Everything else of their apply() does not, and the
+    // masks of the set stay where they are.
+    std::vector<cv::Ptr<BSub> > subtractors = allSubtractors();
+    SubtractorSet set(subtractors, true, 3);
+    set.applyAll(background, 0.1);
+    set.applyAll(input_image, 0.1);
+    std::vector<const unsigned char*> mask_data;
+    for (size_t i = 0; i < set.size(); i++) {
+        mask_data.push_back(set.mask(i).data);
+    }
+
+    for (int f = 0; f < 6; f++) {
+        set.applyAll(f % 2 == 0 ? background : input_image, 0.1);
+        for (size_t i = 0; i < set.size(); i++) {
+            ASSERT_EQ(mask_data[i], set.mask(i).data);
+            ASSERT_EQ(cv::countNonZero(set.mask(i)), set.count(i));
+        }
+    }
+
+    for (size_t i = 0; i < subtractors.size(); i++) {
+        countAllocations(*subtractors[i], 4);
+        ASSERT_EQ(0, countAllocations(*subtractors[i], 10));
+    }
+}
+#endif
+
+} // namespace